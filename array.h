@@ -12,6 +12,11 @@
 *
 *   for (int i = 0; i < array_len(d); ++i)
 *     printf("%f\n", d[i]);
+*
+*   An array can also start out in a buffer, usually on the stack, and only allocate once it outgrows it:
+*
+*   ArrayBuffer(int, 32) buf;
+*   Array(int) a = array_init_buffer(buf);
 */
 
 /* API */
@@ -30,9 +35,20 @@
   #define ARRAY_FREE free
 #endif
 
+/* Like ARRAY_REALLOC, but is also given the old size, for allocators that can't look it up, like arenas.
+ * ptr is 0 and old_size is 0 for a new array */
+#ifndef ARRAY_REALLOC_SIZED
+  #define ARRAY_REALLOC_SIZED(ptr, old_size, new_size) ARRAY_REALLOC(ptr, new_size)
+#endif
+
 /* For annotating array types, since they just look like pointers */
 #define Array(type) type*
 
+/* Storage for an array of up to size elements, to give to array_init_buffer() */
+#define ArrayBuffer(type, size) struct { long long n, c; type items[size]; }
+/* An empty array in the storage of buf. Growing past it moves the array to the heap, and the buffer is never freed */
+#define array_init_buffer(buf) ((buf).n = 0, (buf).c = ARRAY__BORROWED | (long long)(sizeof((buf).items)/sizeof(*(buf).items)), (buf).items)
+
 #define array_insert(a, i, x) (array_resize((a), array_len(a)+1), memmove((a)+(i)+1, (a)+(i), (array__n(a) - (i)) * sizeof(*(a))), (a)[i] = (x))
 #define array_insert_n(a, i, n) (array_resize((a), array_len(a)+(n)), memmove((a)+(i)+(n), (a)+(i), (array__n(a)-(n)-(i)) * sizeof(*(a))))
 #define array_insert_a(a, i, val, n) (array_resize((a), array_len(a)+(n)), memmove((a)+(i)+(n), (a)+(i), (array__n(a)-(n)-(i)) * sizeof(*(a))), memcpy((a)+(i), val, (n)*sizeof(*(val))))
@@ -40,13 +56,14 @@
 #define array_len_get(a) (array__n(a))
 #define array_push(a, val) ((!(a) || array__n(a) == array__c(a) ? (a)=array__grow(a, sizeof(*(a)), 1) : 0), (a)[array__n(a)++] = val)
 #define array_push_a(a, val, n) ((n) ? (array_resize(a, array_len(a)+(n)), memcpy((a)+array__n(a)-(n), val, (n) * sizeof(*(val)))) : 0)
-#define array_push_n(a, n) ((!(a) || array__n(a)+(n) >= array__c(a) ? (a)=array__grow(a, sizeof(*(a)), (n)) : 0), array__n(a) += (n))
+#define array_push_n(a, n) ((!(a) || array__n(a)+(n) > array__c(a) ? (a)=array__grow(a, sizeof(*(a)), (n)) : 0), array__n(a) += (n))
 #define array_last(a) (!(a) ? 0 : (a)+array__n(a)-1)
 #define array_end(a) (!(a) ? 0 : (a)+array__n(a))
-#define array_free(a) (((a) ? ARRAY_FREE(&array__n(a)),0 : 0), (a) = 0)
+#define array_free(a) (((a) && !array__borrowed(a) ? ARRAY_FREE(&array__n(a)),0 : 0), (a) = 0)
 #define array_cap(a) ((a) ? array__c(a) : 0)
 #define array_resize(a, n) ((n) > array_len(a) ? array_push_n(a, (n) - array_len(a)) : ((a) ? (array__n(a) = (n)) : 0))
-#define array_reserve(a, n) ((n) > array_len(a) ? array_resize((a), (n)) : 0)
+/* Makes room for n elements in total, without changing the length */
+#define array_reserve(a, n) ((n) > array_cap(a) ? (a)=array__grow(a, sizeof(*(a)), (n) - array_len(a)) : 0)
 /* Preserves ordering */
 #define array_remove_slow(a, i) ((a) && array__n(a) > 0 ? memmove((a)+(i), (a)+(i)+1, sizeof(*(a)) * (array__n(a)-i-1)), --array__n(a) : 0)
 #define array_remove_slow_n(a, i, n) ((a) && array__n(a) > 0 ? memmove((a)+(i), (a)+(i)+(n), sizeof(*(a)) * (array__n(a)-i-(n))), array__n(a)-=(n) : 0)
@@ -57,16 +74,31 @@
 #define array_find(a, ptr, expr) {for ((ptr) = (a); (ptr) && (ptr) < (a)+array_len(a); ++(ptr)) {if (expr) break;} if ((ptr) == (a)+array_len(a)) {(ptr) = 0;}}
 
 /* Internals */
-#define array__c(a) ((int*)(a))[-1]
-#define array__n(a) ((int*)(a))[-2]
-static void* array__grow(void* a, int size, int num) {
-  /* TODO: ensure we are always power of 2 */
-  int newc = a ? (num + array__n(a) > array__c(a)*2 ? num + array__n(a) : array__c(a)*2) : (num > ARRAY_INITIAL_SIZE ? num : ARRAY_INITIAL_SIZE);
-  int n = a ? array__n(a) : 0;
-  a = (int*)ARRAY_REALLOC(a ? &array__n(a) : 0, newc*size + 2*sizeof(int)) + 2;
-  array__n(a) = n;
-  array__c(a) = newc;
-  return a;
+#include <string.h>
+/* The length and capacity are stored as 64-bit numbers before the elements, so an array can hold more than 2 GiB */
+/* set in the capacity of arrays whose storage is not theirs to free */
+#define ARRAY__BORROWED (1ll << 62)
+#define array__c(a) (((long long*)(a))[-1] & ~ARRAY__BORROWED)
+#define array__n(a) ((long long*)(a))[-2]
+#define array__borrowed(a) (((long long*)(a))[-1] & ARRAY__BORROWED)
+/* Makes room for num more elements. The capacity is always a power of 2 */
+static void* array__grow(void* a, long long size, long long num) {
+  long long n, c, newc;
+  long long *p;
+
+  n = a ? array__n(a) : 0;
+  c = a ? array__c(a) : 0;
+  for (newc = ARRAY_INITIAL_SIZE; newc < n + num || newc < c; newc *= 2);
+
+  if (a && array__borrowed(a)) {
+    p = (long long*)ARRAY_REALLOC_SIZED(0, 0, newc*size + 2*sizeof(long long)) + 2;
+    memcpy(p, a, n*size);
+  }
+  else
+    p = (long long*)ARRAY_REALLOC_SIZED(a ? &array__n(a) : 0, a ? c*size + 2*sizeof(long long) : 0, newc*size + 2*sizeof(long long)) + 2;
+  p[-2] = n;
+  p[-1] = newc;
+  return p;
 }
 
 #endif /* ARRAY_H */
@@ -2,10 +2,12 @@
  * Add BER encoder, so we can save edits
  * Just render the part of the tree that's going to show on screen
  * Support object editing
- * Support Bit string (with enum specs) and Enum
  * Support explicit tags
  */
 
+/* 64-bit file offsets on 32-bit systems */
+#define _FILE_OFFSET_BITS 64
+
 #include "defs.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,6 +15,7 @@
 #include <errno.h>
 #include <time.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <inttypes.h>
 #include <stdint.h>
@@ -21,10 +24,23 @@
 #if defined(_WIN32) || defined(_WIN64)
 /* windows */
   #include <io.h>
+  #define ftell64 _ftelli64
+  #define fseek64 _fseeki64
 #else
 /* linux */
   #define COMPILE_INTERACTIVE_MODE
+  #define COMPILE_BATCH_MODE
+  #define COMPILE_WATCH_MODE
   #include <unistd.h>
+  #include <dirent.h>
+  #include <sys/stat.h>
+  #include <sys/wait.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <sys/inotify.h>
+  #include <poll.h>
+  #define ftell64 ftello
+  #define fseek64 fseeko
 #endif
 
 #ifdef COMPILE_INTERACTIVE_MODE
@@ -52,26 +68,26 @@ const char *NORMAL = "";
 
 typedef uint64_t u64;
 STATIC_ASSERT(sizeof(u64) == 8, u64_is_64bit);
+/* sizes and offsets in the data, which can be larger than 2 GiB */
+typedef int64_t i64;
+STATIC_ASSERT(sizeof(i64) == 8, i64_is_64bit);
 
+/* A decoded value. The objects of a tree are laid out in one array in pre-order, so the children
+ * of an object come right after it, and its subtree ends where its next sibling starts */
 typedef struct Object Object;
 struct Object {
-
-  /* asn1 data */
-  Object *parent;
-  const char *name;
   ASN1_Type *type;
+  /* the name of the field, which belongs to the schema. 0 for list items, which are labelled by object_name() */
+  const char *name;
+  /* indices of the first object after the subtree, and of the parent, which is -1 for the root.
+   * decode() makes sure there are never more than INT_MAX objects */
+  int end, parent;
+  /* the position of a list item, from 1, or 0 if it is not one */
+  int item;
   union {
+    /* IA5String, UTF8String, OCTET STRING. Points into the data */
     struct {
-      Object *value;
-    } choice;
-
-    struct {
-      Array(Object*) values;
-    } sequence;
-
-    /* IA5String, UTF8String, OCTET STRING */
-    struct {
-      int len;
+      i64 len;
       unsigned char *value;
     } string;
 
@@ -79,11 +95,16 @@ struct Object {
       u64 value;
     } integer;
   } data;
-
-  /* rendering data */
-  char collapsed;
 };
 
+typedef struct {
+  Constraint *constraint;
+  /* where it was first violated */
+  const char *name;
+  i64 pos;
+  int count;
+} ConstraintViolation;
+
 #define IS_UTF8_TRAIL(c) (((c)&0xC0) == 0x80)
 #define isset(x, flag) ((x) & (flag))
 
@@ -97,10 +118,25 @@ static struct {
   Array(unsigned char) data_begin;
   unsigned char *data;
   const char *filename;
+  /* where data_begin is in the file. --follow moves it by dropping the records it has printed, and --watch starts past the ones it printed before */
+  i64 data_offset;
 
   Array(ASN1_Typedef) types;
 
-  Object *current_object;
+  /* the decoded tree, and whether each object in it is collapsed, which is only kept in interactive mode */
+  Array(Object) objects;
+  Array(char) collapsed;
+  int current_object;
+
+  /* if set, constraint violations are counted instead of exiting */
+  int count_violations;
+  Array(ConstraintViolation) violations;
+
+  /* if set, the types encoded in OCTET and BIT STRINGs are only decoded when they are shown */
+  int lazy_contents;
+
+  /* if set, long strings are shown in full instead of just their first bytes */
+  int full_values;
 
   #ifdef COMPILE_INTERACTIVE_MODE
     WINDOW *statusw, *objw, *editw, *edit_input;
@@ -201,7 +237,7 @@ static void print_debug(const char *fmt, ...) {
 }
 
 static void vprint_error(const char *fmt, va_list args) {
-  printf("\n\n%sError at byte %i: ", RED, (int)(Global.data - Global.data_begin));
+  printf("\n\n%sError at byte %"PRId64 ": ", RED, Global.data_offset + (i64)(Global.data - Global.data_begin));
   vprintf(fmt, args);
   printf("%s", NORMAL);
 }
@@ -258,7 +294,7 @@ enum {
   LENGTH_INDEFINITE = -2
 };
 
-static int _ber_length_read() {
+static i64 _ber_length_read() {
   unsigned char c;
   c = next();
 
@@ -272,9 +308,13 @@ static int _ber_length_read() {
 
   /* definite long ? */
   if (c & 0x7F) {
-    int i, result;
+    int i;
+    i64 result;
 
+    /* one byte less than fits, so the result can't overflow */
     i = c & 0x7F;
+    if (i > (int)sizeof(i64) - 1)
+      die("Length field of %i bytes is too large\n", i);
     result = 0;
     while (i--) {
       c = next();
@@ -285,14 +325,13 @@ static int _ber_length_read() {
     return result;
   }
 
-  /* indefinite not supported */
-  die("Indefinite length encoding not supported\n");
-  return -1;
+  /* indefinite, the contents end with an end-of-contents marker */
+  return LENGTH_INDEFINITE;
 }
 
-static int ber_length_read() {
-  int l = _ber_length_read();
-  print_debug("Length: %i\n", l);
+static i64 ber_length_read() {
+  i64 l = _ber_length_read();
+  print_debug("Length: %"PRId64 "\n", l);
   return l;
 }
 
@@ -313,19 +352,96 @@ static BerIdentifier ber_identifier_read() {
   return i;
 }
 
-static long file_get_size(FILE *file) {
-  long result, old_pos;
+/* Finds the end-of-contents marker (0x00 0x00) that ends indefinite length contents starting at p.
+ * Only headers are read: definite length elements are hopped over, and nested indefinite length
+ * elements just increase the depth, so the contents are scanned once.
+ * Returns 0 if the contents are malformed or run past end */
+static unsigned char *ber_eoc_find(unsigned char *p, unsigned char *end) {
+  int depth = 0, i;
+  i64 len;
+
+  for (;;) {
+    if (end - p < 2)
+      return 0;
+
+    /* end-of-contents */
+    if (p[0] == 0 && p[1] == 0) {
+      if (!depth)
+        return p;
+      --depth;
+      p += 2;
+      continue;
+    }
+
+    /* identifier */
+    if ((*p++ & 0x1f) == 0x1f) {
+      while (p < end && (*p & 0x80))
+        ++p;
+      ++p;
+    }
+    if (p >= end)
+      return 0;
+
+    /* length */
+    len = *p++;
+    if (len == 0x80) {
+      ++depth;
+      continue;
+    }
+    if (len & 0x80) {
+      i = len & 0x7f;
+      if (i > (int)sizeof(i64) - 1 || end - p < i)
+        return 0;
+      for (len = 0; i--;)
+        len = (len << 8) | *p++;
+    }
+    if (end - p < len)
+      return 0;
+    p += len;
+  }
+}
+
+/* Reads a length, and returns where the contents end.
+ * For indefinite lengths, that is where the end-of-contents marker starts, and it is up to
+ * the caller to call ber_eoc_skip() when it is done with the contents */
+static unsigned char *ber_contents_end_read(int *indefinite) {
+  unsigned char *end;
+  i64 len;
+
+  len = ber_length_read();
+  *indefinite = len == LENGTH_INDEFINITE;
+  if (!*indefinite) {
+    /* checked before adding, since a huge length could wrap the pointer around */
+    if (len > array_end(Global.data_begin) - Global.data)
+      die("Went past end of data, exiting..\n");
+    return Global.data + len;
+  }
+
+  end = ber_eoc_find(Global.data, array_end(Global.data_begin));
+  if (!end)
+    die("Found no end-of-contents for indefinite length element\n");
+  return end;
+}
+
+static void ber_eoc_skip(void) {
+  if (Global.data[0] != 0 || Global.data[1] != 0)
+    die("Expected end-of-contents\n");
+  Global.data += 2;
+}
+
+static i64 file_get_size(FILE *file) {
+  i64 result, old_pos;
 
-  old_pos = ftell(file);
-  fseek(file, 0, SEEK_END);
-  result = ftell(file);
-  fseek(file, old_pos, SEEK_SET);
+  old_pos = ftell64(file);
+  fseek64(file, 0, SEEK_END);
+  result = ftell64(file);
+  fseek64(file, old_pos, SEEK_SET);
   return result;
 }
 
 static Array(unsigned char) file_get_contents(const char *filename) {
   FILE *f;
-  long num_read;
+  i64 num_read;
   Array(unsigned char) data;
 
   data = 0;
@@ -363,6 +479,129 @@ static int ber_identifier_eq(BerIdentifier a, BerIdentifier b) {
   return a.pc == b.pc && a.class == b.class && a.tag_number == b.tag_number;
 }
 
+/** CONSTRAINTS **/
+
+static const char *constraint_to_string(Constraint *c) {
+  static char result[80];
+  char min[24], max[24];
+
+  if (isset(c->flags, CONSTRAINT_HAS_MIN))
+    sprintf(min, "%lld", c->min);
+  else
+    strcpy(min, "MIN");
+  if (isset(c->flags, CONSTRAINT_HAS_MAX))
+    sprintf(max, "%lld", c->max);
+  else
+    strcpy(max, "MAX");
+
+  sprintf(result, isset(c->flags, CONSTRAINT_SIZE) ? "(SIZE(%s..%s%s))" : "(%s..%s%s)", min, max, isset(c->flags, CONSTRAINT_EXTENSIBLE) ? ", ..." : "");
+  return result;
+}
+
+/* Extensible constraints are never violated, since values outside the root are allowed */
+static int constraint_holds(Constraint *c, long long value) {
+  if (isset(c->flags, CONSTRAINT_EXTENSIBLE))
+    return 1;
+  if (isset(c->flags, CONSTRAINT_HAS_MIN) && value < c->min)
+    return 0;
+  if (isset(c->flags, CONSTRAINT_HAS_MAX) && value > c->max)
+    return 0;
+  return 1;
+}
+
+/* The value a constraint on a primitive type applies to.
+ * *fits is set to 0 for an INTEGER or ENUMERATED too long for a long long, which violates any range, and whose
+ * value is given as the smallest or largest long long */
+static long long constraint_value(ASN1_Type *type, unsigned char *data, i64 len, int *fits) {
+  long long result;
+  u64 bits;
+  int i;
+
+  *fits = 1;
+  switch (type->type) {
+    case TYPE_ENUM:
+    case TYPE_INTEGER:
+      if (!len)
+        return 0;
+      if (len > 8) {
+        *fits = 0;
+        return data[0] & 0x80 ? LLONG_MIN : LLONG_MAX;
+      }
+      /* two's complement, sign extended from the first byte */
+      bits = data[0] & 0x80 ? ~(u64)0 : 0;
+      for (i = 0; i < len; ++i)
+        bits = (bits << 8) | data[i];
+      return (long long)bits;
+
+    case TYPE_BIT_STRING:
+      /* the first byte is the number of unused bits */
+      return len ? (long long)(len-1)*8 - data[0] : 0;
+
+    case TYPE_UTF8_STRING:
+      for (result = 0, i = 0; i < len; ++i)
+        if (!IS_UTF8_TRAIL(data[i]))
+          ++result;
+      return result;
+
+    default:
+      return len;
+  }
+}
+
+/* The name an object is shown with. List items are labelled with their position, which is written to buf */
+static const char *object_name(Object *object, char *buf) {
+  if (!object->item)
+    return object->name;
+  sprintf(buf, "item #%i", object->item);
+  return buf;
+}
+
+/* Counts a violation at byte pos, for --count-violations */
+static void constraint_violation_count(Constraint *c, const char *name, i64 pos) {
+  ConstraintViolation *v, new_violation;
+
+  array_find(Global.violations, v, v->constraint == c);
+  if (v) {
+    ++v->count;
+    return;
+  }
+  new_violation.constraint = c;
+  new_violation.name = strdup(name);
+  new_violation.pos = pos;
+  new_violation.count = 1;
+  array_push(Global.violations, new_violation);
+}
+
+static void constraint_violation(Constraint *c, const char *name, long long value) {
+  if (!Global.count_violations)
+    die("%s is %lld, which violates its constraint %s\n", name, value, constraint_to_string(c));
+  constraint_violation_count(c, name, Global.data_offset + (Global.data - Global.data_begin));
+}
+
+static void constraint_check(ASN1_Type *type, Object *object, unsigned char *data, i64 len) {
+  char item_name[32];
+  long long value;
+  int fits;
+
+  value = constraint_value(type, data, len, &fits);
+  if (!fits || !constraint_holds(type->primitive.constraint, value))
+    constraint_violation(type->primitive.constraint, object_name(object, item_name), value);
+}
+
+static void print_violations(void) {
+  ConstraintViolation *v;
+  int total = 0;
+
+  if (!Global.count_violations)
+    return;
+
+  array_foreach(Global.violations, v) {
+    printf("%sConstraint %s violated %i times, first by %s at byte %"PRId64 "%s\n", RED, constraint_to_string(v->constraint), v->count, v->name, v->pos, NORMAL);
+    total += v->count;
+  }
+  printf("%i constraint violations\n", total);
+}
+
 #if 1
 static void print_definition(ASN1_Type *t, int indent) {
   if (indent > 10)
@@ -405,7 +644,7 @@ static void print_definition(ASN1_Type *t, int indent) {
       printf("BOOLEAN");
       break;
     case TYPE_ENUM:
-      printf("ENUM");
+      printf("ENUMERATED");
       break;
     case TYPE_OCTET_STRING:
       printf("OCTET STRING");
@@ -417,13 +656,18 @@ static void print_definition(ASN1_Type *t, int indent) {
       printf("INTEGER");
       break;
     case TYPE_LIST:
-      printf("list of ");
+      if (t->list.constraint)
+        printf("list %s of ", constraint_to_string(t->list.constraint));
+      else
+        printf("list of ");
       print_definition(t->list.item_type, indent);
       break;
     case TYPE_UTF8_STRING:
       printf("UTF8String");
       break;
   }
+  if (t->type != TYPE_LIST && asn1_type_constraint(t))
+    printf(" %s", constraint_to_string(asn1_type_constraint(t)));
   putchar('\n');
 }
 #else
@@ -482,57 +726,85 @@ static int ber_tag_is_implicit(Tag *tag) {
 
 static ASN1_Typedef *get_type_by_name(const char *name);
 
-static Object* decode(ASN1_Type *type, char *name, BerIdentifier *bi, unsigned char *end, int indent) {
+/* The value of INTEGER or ENUMERATED contents.
+ * ENUMERATED values are signed, so we can look up negative ones */
+/* Returns 0 if the value is longer than the 8 bytes that fit in *value */
+static int ber_integer_value(ASN1_Type *type, const unsigned char *data, i64 len, u64 *value) {
+  u64 i = 0;
+
+  if (len > 8)
+    return 0;
+  if (type->type == TYPE_ENUM && len && (data[0] & 0x80))
+    i = ~i;
+  for (; len; --len)
+    i <<= 8, i |= *data++;
+  *value = i;
+  return 1;
+}
+
+static int type_is_string(ASN1_Type *type) {
+  return type->type == TYPE_OCTET_STRING || type->type == TYPE_BIT_STRING;
+}
+
+/* Appends the value and its children to Global.objects, and returns its index, or -1 at the end of the data.
+ * Indices are used rather than pointers, since the array moves as it grows */
+static int decode(ASN1_Type *type, const char *name, int item, BerIdentifier *bi, unsigned char *end, int indent) {
   Object *object;
   BerIdentifier ber_identifier;
   unsigned char *start;
+  char item_name[32];
+  int me, child;
 
   if (Global.data >= array_end(Global.data_begin))
-    return 0;
+    return -1;
 
-  object = malloc(sizeof(Object));
+  if (array_len(Global.objects) >= INT_MAX)
+    die("More than %i values to keep in memory at once\n", INT_MAX);
+  me = array_len(Global.objects);
+  array_push_n(Global.objects, 1);
+  object = Global.objects + me;
   memset(object, 0, sizeof(*object));
-  object->name = strdup(name);
+  object->name = name;
+  object->item = item;
   object->type = type;
-  object->parent = 0;
+  object->parent = -1;
 
   start = Global.data;
 
   switch (type->type) {
     case TYPE_CHOICE: {
       Tag *tag;
-      int len;
+      int indefinite;
 
       ber_identifier = bi ? *bi : ber_identifier_read();
-      len = ber_length_read();
-      end = Global.data + len;
+      end = ber_contents_end_read(&indefinite);
 
       /* find a matching tag */
       tag = ber_find_matching_tag(type->choice.choices, array_len(type->choice.choices), ber_identifier);
       if (!tag) {
-        print_error("For CHOICE %s, BER tag number was %i, but no such choice exists.\n", name, ber_identifier.tag_number);
+        print_error("For CHOICE %s, BER tag number was %i, but no such choice exists.\n", object_name(Global.objects + me, item_name), ber_identifier.tag_number);
         printf("Available tags:\n");
         print_definition(type, indent);
         exit(1);
       }
 
-      if (ber_identifier.pc == BER_CONSTRUCTED)
+      if (ber_identifier.pc == BER_CONSTRUCTED && Global.data < end)
         ber_identifier = ber_identifier_read();
 
-      object->data.choice.value = decode(tag->type, tag->name,
-                                       &ber_identifier,
-                                       end,
-                                       indent+1);
-      object->data.choice.value->parent = object;
+      child = decode(tag->type, tag->name, 0,
+                     &ber_identifier,
+                     end,
+                     indent+1);
+      Global.objects[child].parent = me;
+
+      if (indefinite)
+        ber_eoc_skip();
     } break;
 
     case TYPE_SEQUENCE: {
       Tag *tag, *next;
       unsigned char *item_end;
-      int item_length, first = 1;
-      Object *d;
-
-      object->data.sequence.values = 0;
+      int indefinite, first = 1;
 
       if (Global.data == end)
         break;
@@ -546,8 +818,9 @@ static Object* decode(ASN1_Type *type, char *name, BerIdentifier *bi, unsigned c
           ber_identifier = ber_identifier_read();
         first = 0;
 
-        item_length = ber_length_read();
-        item_end = Global.data + item_length;
+        item_end = ber_contents_end_read(&indefinite);
+        if (indefinite && ber_identifier.pc == BER_PRIMITIVE)
+          die("Indefinite length on a primitive element\n");
 
         if (Global.data >= end)
           break;
@@ -569,22 +842,20 @@ static Object* decode(ASN1_Type *type, char *name, BerIdentifier *bi, unsigned c
         }
         next = tag+1;
 
-        d = decode(tag->type, tag->name, ber_identifier.pc == BER_PRIMITIVE ? &ber_identifier : 0, item_end, indent+1);
-        d->parent = object;
-        array_push(object->data.sequence.values, d);
+        child = decode(tag->type, tag->name, 0, ber_identifier.pc == BER_PRIMITIVE ? &ber_identifier : 0, item_end, indent+1);
+        Global.objects[child].parent = me;
+
+        if (indefinite)
+          ber_eoc_skip();
       }
 
       if (Global.data != end)
-        die("Expected to read %i bytes from sequence, but it was of size %i\n", end-start, Global.data-start);
+        die("Expected to read %"PRId64 " bytes from sequence, but it was of size %"PRId64 "\n", (i64)(end-start), (i64)(Global.data-start));
     } break;
 
     case TYPE_LIST: {
-      int i, item_length, first = 1;
+      int i, indefinite, first = 1;
       unsigned char *item_end;
-      char item_name[32];
-      Object *d;
-
-      object->data.sequence.values = 0;
 
       if (Global.data == end)
         break;
@@ -597,77 +868,67 @@ static Object* decode(ASN1_Type *type, char *name, BerIdentifier *bi, unsigned c
         if (!first)
           ber_identifier = ber_identifier_read();
         first = 0;
-        item_length = ber_length_read();
-        item_end = Global.data + item_length;
+        item_end = ber_contents_end_read(&indefinite);
+        if (indefinite && ber_identifier.pc == BER_PRIMITIVE)
+          die("Indefinite length on a primitive element\n");
 
         if (Global.data == end)
           break;
 
-        sprintf(item_name, "item #%i", i);
-        d = decode(type->list.item_type, item_name, 0, item_end, indent+1);
-        d->parent = object;
-        array_push(object->data.sequence.values, d);
+        child = decode(type->list.item_type, 0, i, 0, item_end, indent+1);
+        Global.objects[child].parent = me;
+
+        if (indefinite)
+          ber_eoc_skip();
       }
 
       if (Global.data != end)
-        die("List should be %i long, but was at least %i\n", end-start, Global.data-start);
+        die("List should be %"PRId64 " long, but was at least %"PRId64 "\n", (i64)(end-start), (i64)(Global.data-start));
+
+      if (type->list.constraint && !constraint_holds(type->list.constraint, i-1))
+        constraint_violation(type->list.constraint, object_name(Global.objects + me, item_name), i-1);
     } break;
 
     case TYPE_BOOLEAN: {
       if (end - Global.data != 1)
-        die("Length of boolean was not 1, but %i\n", end - Global.data);
+        die("Length of boolean was not 1, but %"PRId64 "\n", (i64)(end - Global.data));
 
       object->data.integer.value = next();
     } break;
 
+    case TYPE_ENUM:
     case TYPE_INTEGER: {
-      u64 i;
-      int len;
-
-      /* TODO: handle enumdecls */
-
-      len = end - Global.data;
-
-      for (i = 0; len; --len)
-        i <<= 8, i |= next();
-      object->data.integer.value = i;
-    } break;
-
-    case TYPE_OCTET_STRING:
-    case TYPE_BIT_STRING: {
-      int len;
+      i64 len;
 
       len = end - Global.data;
+      check_end(end);
 
-      /* polystar special sauce */
-      if (strcmp(name, "cdrData") == 0) {
-        ASN1_Typedef *xdr_type;
-        xdr_type = get_type_by_name("XDR-TYPE");
-        if (xdr_type) {
-          free(object);
-          object = decode(xdr_type->type, "cdrData", 0, end, indent+1);
-          break;
-        }
-      }
-
-      /* copy the string just in case the raw data stops existing */
-      object->data.string.value = malloc(len);
-      object->data.string.len = len;
-      memcpy(object->data.string.value, Global.data, len);
-
+      if (!ber_integer_value(type, Global.data, len, &object->data.integer.value))
+        die("%s is %"PRId64 " bytes long, which is more than 8\n", object_name(Global.objects + me, item_name), len);
+      if (type->primitive.constraint)
+        constraint_check(type, Global.objects + me, Global.data, len);
       Global.data = end;
     } break;
 
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING:
     case TYPE_PRINTABLE_STRING:
     case TYPE_IA5_STRING:
     case TYPE_UTF8_STRING: {
-      int len;
+      i64 len;
 
       len = end - Global.data;
-      object->data.string.value = malloc(len);
-      object->data.string.len = len;
-      memcpy(object->data.string.value, Global.data, len);
+      if (type->primitive.constraint)
+        constraint_check(type, Global.objects + me, Global.data, len);
+
+      /* the contained type takes the place of the string, unless it is decoded later by object_expand_contents() */
+      if (type_is_string(type) && type->primitive.contains && !Global.lazy_contents) {
+        array_resize(Global.objects, me);
+        return decode(type->primitive.contains, name, item, 0, end, indent+1);
+      }
 
+      object->data.string.value = Global.data;
+      object->data.string.len = len;
       Global.data = end;
     } break;
 
@@ -677,839 +938,2914 @@ static Object* decode(ASN1_Type *type, char *name, BerIdentifier *bi, unsigned c
       exit(1);
   }
 
-  return object;
+  Global.objects[me].end = array_len(Global.objects);
+  return me;
 }
 
-static void init_colors() {
-  int is_a_terminal;
+/** VALIDATION **/
 
-#if defined(_WIN32) || defined(_WIN64)
-  is_a_terminal = _isatty(fileno(stdout));
-#else
-  is_a_terminal = isatty(fileno(stdout));
-#endif
+/* validate() walks the same path as decode(), but builds nothing and never dies.
+ * Every length is checked against its container, so a bad record can be reported and skipped */
 
-  if (is_a_terminal) {
-    RED = RED_STR;
-    GREEN = GREEN_STR;
-    YELLOW = YELLOW_STR;
-    BLUE = BLUE_STR;
-    MAGENTA = MAGENTA_STR;
-    CYAN = CYAN_STR;
-    NORMAL = NORMAL_STR;
-  }
-}
+static struct {
+  unsigned char *pos;
+  char msg[128];
+} validate_error;
 
-static void print_usage() {
-  printf(
-    "Usage: decoder ASN1FILE... BINARY TYPENAME\n"
-    "\n"
-    "    --interactive  interactive mode\n"
-  );
+static int validate_fail(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  validate_error.pos = Global.data;
+  vsnprintf(validate_error.msg, sizeof(validate_error.msg), fmt, args);
+  va_end(args);
+  return 0;
 }
 
-static int is_option(const char *str) {
-  return str[0] == '-' && str[1] == '-';
-}
+static int validate_identifier_read(BerIdentifier *i, unsigned char *end) {
+  unsigned char c;
 
-static ASN1_Typedef *get_type_by_name(const char *name) {
-  ASN1_Typedef *t;
-  array_find(Global.types, t, strcmp(t->name, name) == 0);
-  return t;
-}
+  if (Global.data >= end)
+    return validate_fail("Unexpected end of data when reading identifier");
+  c = *Global.data++;
+  i->class = (c & 0xC0) >> 6;
+  i->pc = !!(c & 0x20);
+  i->tag_number = c & 0x1f;
 
-#define MIN(a,b) ((b) < (a) ? (b) : (a))
-#define MAX(a,b) ((a) < (b) ? (b) : (a))
+  if (i->tag_number != 0x1f)
+    return 1;
 
-static int type_is_primitive(ASN1_Type *type) {
-  switch (type->type) {
-    case TYPE_UNKNOWN:
-    case TYPE_NULL:
-    case TYPE_SEQUENCE:
-    case TYPE_CHOICE:
-    case TYPE_LIST:
-    case _TYPE_REFERENCE:
-      return 0;
-    case TYPE_BOOLEAN:
-    case TYPE_ENUM:
-    case TYPE_OCTET_STRING:
-    case TYPE_BIT_STRING:
-    case TYPE_UTF8_STRING:
-    case TYPE_IA5_STRING:
-    case TYPE_PRINTABLE_STRING:
-    case TYPE_INTEGER:
-      return 1;
-  }
-  return 0;
+  i->tag_number = 0;
+  do {
+    if (Global.data >= end)
+      return validate_fail("Unexpected end of data when reading tag number");
+    c = *Global.data++;
+    i->tag_number = (i->tag_number << 7) | (c & 0x7f);
+  } while (c & 0x80);
+  return 1;
 }
 
-static int type_is_compound(ASN1_Type *type) {
-  switch (type->type) {
-    case TYPE_UNKNOWN:
-    case TYPE_NULL:
-    case _TYPE_REFERENCE:
-    case TYPE_BOOLEAN:
-    case TYPE_ENUM:
-    case TYPE_OCTET_STRING:
-    case TYPE_BIT_STRING:
-    case TYPE_UTF8_STRING:
-    case TYPE_IA5_STRING:
-    case TYPE_PRINTABLE_STRING:
-    case TYPE_INTEGER:
-      return 0;
-    case TYPE_SEQUENCE:
-    case TYPE_CHOICE:
-    case TYPE_LIST:
-      return 1;
+static int validate_length_read(i64 *len, unsigned char *end) {
+  unsigned char c;
+  int i;
+
+  if (Global.data >= end)
+    return validate_fail("Unexpected end of data when reading length");
+  c = *Global.data++;
+
+  if (!(c & 0x80)) {
+    *len = c;
+    return 1;
   }
-  return 0;
+  if ((c & 0x7F) == 0x7F)
+    return validate_fail("Reserved length field");
+  if (!(c & 0x7F)) {
+    *len = LENGTH_INDEFINITE;
+    return 1;
+  }
+
+  i = c & 0x7F;
+  if (i > (int)sizeof(i64) - 1)
+    return validate_fail("Length field of %i bytes is too large", i);
+  if (end - Global.data < i)
+    return validate_fail("Unexpected end of data when reading length");
+
+  for (*len = 0; i--;)
+    *len = (*len << 8) | *Global.data++;
+  return 1;
 }
 
-static void object_get_children(Object *parent, Object ***children, int *num_children) {
-  *children = 0;
-  *num_children = 0;
-  if (type_is_primitive(parent->type))
-    return;
+/* Like ber_contents_end_read(), the end of indefinite length contents is where the end-of-contents starts */
+static int validate_contents_end_read(unsigned char **contents_end, int *indefinite, unsigned char *end) {
+  i64 len;
 
-  switch (parent->type->type) {
-    case TYPE_CHOICE:
-      *children = &parent->data.choice.value;
-      *num_children = 1;
-      break;
-    case TYPE_SEQUENCE:
-    case TYPE_LIST:
-      *children = parent->data.sequence.values;
-      *num_children = array_len(parent->data.sequence.values);
-      break;
+  if (!validate_length_read(&len, end))
+    return 0;
 
-    default:
-      die("Unexpected error");
-      break;
+  *indefinite = len == LENGTH_INDEFINITE;
+  if (*indefinite) {
+    *contents_end = ber_eoc_find(Global.data, end);
+    if (!*contents_end)
+      return validate_fail("Found no end-of-contents for indefinite length element");
+    return 1;
   }
-}
-
-static void object_get_siblings(Object *obj, Object ***siblings, int *num_siblings) {
-  *siblings = 0;
-  *num_siblings = 0;
-  if (!obj->parent)
-    return;
-  object_get_children(obj->parent, siblings, num_siblings);
-}
 
-static u64 octet_to_int(Object *object) {
-  u64 val = 0;
-  int i;
-  for (i = 0; i < object->data.string.len; ++i)
-    val <<= 8, val |= object->data.string.value[i];
-  return val;
+  if (len > end - Global.data)
+    return validate_fail("Length %"PRId64 " exceeds the %"PRId64 " bytes left in the enclosing element", len, (i64)(end - Global.data));
+  *contents_end = Global.data + len;
+  return 1;
 }
 
-static int octet_is_ip_address(Object *object) {
-  /* TODO: ipv6 */
-  return object->data.string.len == 4 && (strstri("ipaddr", object->name) || strstri("ip", object->name));
-}
+static int validate_constraint(ASN1_Type *type, const char *name, unsigned char *end) {
+  long long value;
+  int fits;
 
-static int octet_is_printable(Object *object) {
-  int i;
-  for (i = 0; i < object->data.string.len; ++i)
-    if (!isprint(object->data.string.value[i]))
-      return 0;
+  value = constraint_value(type, Global.data, end - Global.data, &fits);
+  if (!fits || !constraint_holds(type->primitive.constraint, value))
+    return validate_fail("%s is %lld, which violates its constraint %s", name, value, constraint_to_string(type->primitive.constraint));
   return 1;
 }
 
-static char* int_to_time(u64 val) {
-  static char date[32];
-  time_t t;
-  struct tm *tm_time;
+static int validate(ASN1_Type *type, const char *name, BerIdentifier *bi, unsigned char *end) {
+  BerIdentifier ber_identifier;
 
-  t = val/1000;
+  switch (type->type) {
+    case TYPE_CHOICE: {
+      Tag *tag;
+      int indefinite;
 
-  /* 3 years old or 1 day in future is ok */
-  if (t >= time(0) + 60*60*24 || t <= time(0) - 60*60*24*365*3)
-    return 0;
+      if (bi)
+        ber_identifier = *bi;
+      else if (!validate_identifier_read(&ber_identifier, end))
+        return 0;
+      if (!validate_contents_end_read(&end, &indefinite, end))
+        return 0;
 
-  tm_time = localtime(&t);
-  strftime(date, sizeof(date)-1, "%Y-%m-%d %H:%M:%S", tm_time);
-  sprintf(date+19, ".%"PRIu64, val % 1000);
-  return date;
-}
+      tag = ber_find_matching_tag(type->choice.choices, array_len(type->choice.choices), ber_identifier);
+      if (!tag)
+        return validate_fail("For CHOICE %s, BER tag number was %i, but no such choice exists", name, ber_identifier.tag_number);
 
-static char* octet_to_numberstring(Object *object) {
-  static char number[17];
-  int i;
-  char *s = number;
+      if (ber_identifier.pc == BER_CONSTRUCTED && Global.data < end && !validate_identifier_read(&ber_identifier, end))
+        return 0;
 
-  if (object->data.string.len > 8)
-    return 0;
+      if (!validate(tag->type, tag->name, &ber_identifier, end))
+        return 0;
+      if (Global.data != end)
+        return validate_fail("CHOICE %s has %"PRId64 " bytes left over after %s", name, (i64)(end - Global.data), tag->name);
+      if (indefinite)
+        Global.data += 2;
+    } break;
 
-  for (i = 0; i < object->data.string.len; ++i) {
-    unsigned char lo,hi,c;
+    case TYPE_SEQUENCE: {
+      Tag *tag, *next;
+      unsigned char *item_end;
+      int indefinite, first = 1;
 
-    c = object->data.string.value[i];
-    lo = c & 0xf;
-    hi = (c & 0xf0) >> 4;
+      next = type->sequence.items;
 
-    if (lo != 0xf && lo > 9)
-      return 0;
-    if (lo != 0xf)
-      *s++ = '0'+lo;
+      while (Global.data < end) {
+        if (first && bi)
+          ber_identifier = *bi;
+        else if (!validate_identifier_read(&ber_identifier, end))
+          return 0;
+        first = 0;
 
-    if (hi != 0xf && hi > 9)
-      return 0;
-    if (hi != 0xf)
-      *s++ = '0'+hi;
-  }
-  *s = 0;
+        if (!validate_contents_end_read(&item_end, &indefinite, end))
+          return 0;
+        if (indefinite && ber_identifier.pc == BER_PRIMITIVE)
+          return validate_fail("Indefinite length on a primitive element");
+
+        tag = ber_find_matching_tag(next, array_end(type->sequence.items)-next, ber_identifier);
+        if (!tag)
+          return validate_fail("Unable to find matching tag in %s for ber identifier (%i, %i, %i)", name, ber_identifier.class, ber_identifier.pc, ber_identifier.tag_number);
+
+        /* check that we didn't skip any non-optionals */
+        for (; next < tag; ++next)
+          if (!isset(next->flags, TAG_FLAG_OPTIONAL))
+            return validate_fail("Tag %s skips over non-optional tag %s", tag->name, next->name);
+        next = tag+1;
+
+        if (!validate(tag->type, tag->name, ber_identifier.pc == BER_PRIMITIVE ? &ber_identifier : 0, item_end))
+          return 0;
+        if (Global.data != item_end)
+          return validate_fail("%s has %"PRId64 " bytes left over", tag->name, (i64)(item_end - Global.data));
+        if (indefinite)
+          Global.data += 2;
+      }
+
+      /* and that nothing non-optional is missing at the end */
+      for (; next < array_end(type->sequence.items); ++next)
+        if (!isset(next->flags, TAG_FLAG_OPTIONAL))
+          return validate_fail("Non-optional tag %s is missing from %s", next->name, name);
+    } break;
+
+    case TYPE_LIST: {
+      unsigned char *item_end;
+      int indefinite, first = 1, num_items = 0;
+
+      while (Global.data < end) {
+        if (first && bi)
+          ber_identifier = *bi;
+        else if (!validate_identifier_read(&ber_identifier, end))
+          return 0;
+        first = 0;
+
+        if (!validate_contents_end_read(&item_end, &indefinite, end))
+          return 0;
+        if (indefinite && ber_identifier.pc == BER_PRIMITIVE)
+          return validate_fail("Indefinite length on a primitive element");
+
+        if (!validate(type->list.item_type, name, 0, item_end))
+          return 0;
+        if (Global.data != item_end)
+          return validate_fail("Item of %s has %"PRId64 " bytes left over", name, (i64)(item_end - Global.data));
+        if (indefinite)
+          Global.data += 2;
+        if (num_items == INT_MAX)
+          return validate_fail("%s has more than %i items", name, INT_MAX);
+        ++num_items;
+      }
+
+      if (type->list.constraint && !constraint_holds(type->list.constraint, num_items))
+        return validate_fail("%s has %i items, which violates its constraint %s", name, num_items, constraint_to_string(type->list.constraint));
+    } break;
+
+    case TYPE_BOOLEAN:
+      if (end - Global.data != 1)
+        return validate_fail("Length of boolean %s was not 1, but %"PRId64, name, (i64)(end - Global.data));
+      Global.data = end;
+      break;
+
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING:
+      if (type->primitive.constraint && !validate_constraint(type, name, end))
+        return 0;
+      if (type->primitive.contains)
+        return validate(type->primitive.contains, name, 0, end);
+      Global.data = end;
+      break;
+
+    case TYPE_ENUM:
+      if (end - Global.data > 8)
+        return validate_fail("%s is %"PRId64 " bytes long, which is more than 8", name, (i64)(end - Global.data));
+      if (!type->primitive.names->extensible) {
+        int fits;
+        long long value = constraint_value(type, Global.data, end - Global.data, &fits);
+        if (!fits || !asn1_name_lookup(type->primitive.names, value))
+          return validate_fail("%lld is not a value of ENUMERATED %s", value, name);
+      }
+      Global.data = end;
+      break;
+
+    case TYPE_INTEGER:
+      if (end - Global.data > 8)
+        return validate_fail("%s is %"PRId64 " bytes long, which is more than 8", name, (i64)(end - Global.data));
+      if (type->primitive.constraint && !validate_constraint(type, name, end))
+        return 0;
+      Global.data = end;
+      break;
+
+    case TYPE_PRINTABLE_STRING:
+    case TYPE_IA5_STRING:
+    case TYPE_UTF8_STRING:
+      if (type->primitive.constraint && !validate_constraint(type, name, end))
+        return 0;
+      Global.data = end;
+      break;
+
+    default:
+      return validate_fail("Type of %s not supported", name);
+  }
+
+  return 1;
+}
+
+/* Reads the top-level identifier and length at Global.data without moving it.
+ * Returns the end of the record, or 0 if the header itself is broken */
+static unsigned char *record_end_peek(void) {
+  unsigned char *start, *result;
+  BerIdentifier bi;
+  int indefinite;
+
+  start = Global.data;
+  result = 0;
+  if (validate_identifier_read(&bi, array_end(Global.data_begin)) && validate_contents_end_read(&result, &indefinite, array_end(Global.data_begin)) && indefinite)
+    result += 2;
+  Global.data = start;
+  return result;
+}
+
+/** RECORD SELECTION **/
+
+/* Which records --skip, --every, --sample and --limit pick out. The others are stepped over
+ * using only their top-level header, so getting to record N costs N header reads rather than N decodes */
+static struct {
+  i64 skip, every, limit;
+  /* the chance of keeping a record, or 0 to keep all of them */
+  double sample;
+  u64 random;
+  i64 num_seen, num_selected;
+
+  /* --grep, the bytes that a record has to contain to be decoded */
+  Array(unsigned char) needle;
+  /* for a TBCD number with an odd number of digits, the last digit, which is the low half of the byte after the needle. Otherwise -1 */
+  int needle_digit;
+  /* the next place the needle was found, at or after Global.data */
+  unsigned char *hit;
+} record_selection = {0, 1, -1, 0, 1};
+
+/* xorshift64*, so that a seed picks the same sample everywhere */
+static double record_random(void) {
+  u64 x = record_selection.random;
+  x ^= x >> 12, x ^= x << 25, x ^= x >> 27;
+  record_selection.random = x;
+  return (x * 0x2545F4914F6CDD1Dull >> 11) * (1.0 / (1ull << 53));
+}
+
+/* Finds the needle in the data between from and end. It looks for the first byte with memchr(), which is vectorized
+ * in any decent C library, so that with an uncommon first byte this runs at close to the speed of memory */
+static unsigned char *needle_find(unsigned char *from, unsigned char *end) {
+  unsigned char *needle, *p;
+  i64 n, size;
+
+  needle = record_selection.needle;
+  n = array_len(needle);
+  /* an odd last digit is in the byte after the needle, which must be there too */
+  size = n + (record_selection.needle_digit >= 0);
+  for (p = from; end - p >= size; ++p) {
+    p = memchr(p, needle[0], end - p - size + 1);
+    if (!p)
+      return 0;
+    if (memcmp(p+1, needle+1, n-1))
+      continue;
+    if (record_selection.needle_digit >= 0 && (p[n] & 0xf) != record_selection.needle_digit)
+      continue;
+    return p;
+  }
+  return 0;
+}
+
+/* Whether the record at Global.data, which ends at end, contains the --grep needle.
+ * Returns -1 if the needle isn't anywhere in the rest of the data */
+static int record_has_needle(unsigned char *end) {
+  if (!record_selection.hit || record_selection.hit < Global.data)
+    record_selection.hit = needle_find(Global.data, array_end(Global.data_begin));
+  if (!record_selection.hit)
+    return -1;
+  return record_selection.hit < end;
+}
+
+/* Parses a --grep argument, which is hex:BYTES, tbcd:DIGITS or text:TEXT, or just TEXT */
+static int needle_parse(const char *arg) {
+  const char *digits;
+  int i, n, hi, lo;
+
+  record_selection.needle_digit = -1;
+  array_resize(record_selection.needle, 0);
+
+  if (strncmp(arg, "hex:", 4) == 0) {
+    arg += 4;
+    n = strlen(arg);
+    if (!n || n % 2)
+      return 0;
+    for (i = 0; i < n; i += 2) {
+      if (!isxdigit(arg[i]) || !isxdigit(arg[i+1]))
+        return 0;
+      hi = isdigit(arg[i]) ? arg[i] - '0' : tolower(arg[i]) - 'a' + 10;
+      lo = isdigit(arg[i+1]) ? arg[i+1] - '0' : tolower(arg[i+1]) - 'a' + 10;
+      array_push(record_selection.needle, hi << 4 | lo);
+    }
+    return 1;
+  }
+
+  /* the reverse of octet_to_numberstring(), the first digit goes in the low half of each byte */
+  if (strncmp(arg, "tbcd:", 5) == 0) {
+    digits = arg + 5;
+    n = strlen(digits);
+    if (n < 2)
+      return 0;
+    for (i = 0; i < n; ++i)
+      if (!isdigit(digits[i]))
+        return 0;
+    for (i = 0; i+1 < n; i += 2)
+      array_push(record_selection.needle, (digits[i+1] - '0') << 4 | (digits[i] - '0'));
+    if (n % 2)
+      record_selection.needle_digit = digits[n-1] - '0';
+    return 1;
+  }
+
+  if (strncmp(arg, "text:", 5) == 0)
+    arg += 5;
+  n = strlen(arg);
+  if (!n)
+    return 0;
+  array_push_a(record_selection.needle, arg, n);
+  return 1;
+}
+
+static int record_is_selected(i64 index) {
+  if (index < record_selection.skip)
+    return 0;
+  if ((index - record_selection.skip) % record_selection.every)
+    return 0;
+  if (record_selection.sample && record_random() >= record_selection.sample)
+    return 0;
+  return 1;
+}
+
+/* Moves Global.data to the next record that should be decoded. Returns 0 at the end of the data, or once --limit records have been picked */
+static int record_next(void) {
+  unsigned char *end;
+  int selected;
+
+  for (;;) {
+    if (Global.data >= array_end(Global.data_begin) || record_selection.num_selected == record_selection.limit)
+      return 0;
+    selected = record_is_selected(record_selection.num_seen++);
+    if (selected && !record_selection.needle)
+      break;
+
+    end = record_end_peek();
+    if (!end)
+      die("Record %"PRId64 ": %s, can't find the next record\n", record_selection.num_seen-1, validate_error.msg);
+    if (selected) {
+      selected = record_has_needle(end);
+      if (selected < 0)
+        return 0;
+      if (selected)
+        break;
+    }
+    Global.data = end;
+  }
+
+  ++record_selection.num_selected;
+  return 1;
+}
+
+static void set_colors(int on) {
+  RED = GREEN = YELLOW = BLUE = MAGENTA = CYAN = NORMAL = "";
+
+  if (on) {
+    RED = RED_STR;
+    GREEN = GREEN_STR;
+    YELLOW = YELLOW_STR;
+    BLUE = BLUE_STR;
+    MAGENTA = MAGENTA_STR;
+    CYAN = CYAN_STR;
+    NORMAL = NORMAL_STR;
+  }
+}
+
+static int stdout_is_a_terminal() {
+#if defined(_WIN32) || defined(_WIN64)
+  return _isatty(fileno(stdout));
+#else
+  return isatty(fileno(stdout));
+#endif
+}
+
+static void init_colors() {
+  set_colors(stdout_is_a_terminal());
+}
+
+static void print_usage() {
+  printf(
+    "Usage: decoder ASN1FILE... BINARY TYPENAME\n"
+    "\n"
+    "    --interactive       interactive mode\n"
+    "    --validate          only check that each record matches the schema, and print the offsets of those that don't\n"
+    "    --count-violations  count values that violate their SIZE or range constraints, instead of exiting on the first one\n"
+    "    --stream            decode while reading, without loading the whole file. BINARY can be - for stdin\n"
+    "\n"
+    "    --schema-stats      print how much of the schema is reachable from TYPENAME, which is all that is kept\n"
+    "    --module-path=DIR   look for imported modules in DIR, as well as next to the ASN1 files. Can be given more than once\n"
+    "    --contains=PATH=TYPE\n"
+    "                        decode the OCTET or BIT STRING fields at PATH as the encoding of TYPE. PATH is a field name, for every\n"
+    "                        field by that name, or TYPENAME.field.field... Can be given more than once\n"
+    "    --lazy-contents     only decode the types in such fields when they are shown\n"
+    "    --full-values       show long OCTET and BIT STRINGs in full, instead of only their first 20 bytes\n"
+    "    --display-hints=FILE\n"
+    "                        show OCTET and BIT STRING fields as the file says. Each line is a field, like for --contains,\n"
+    "                        and one of guess, ip, time, tbcd, integer, hex or text\n"
+    "\n"
+    "    --skip=N            start at record N, counting from 0. The records before it are stepped over without decoding them\n"
+    "    --every=K           only show every K:th record after that\n"
+    "    --sample=P          only show each record with a chance of P, like 0.01\n"
+    "    --seed=N            the seed for --sample, to pick another sample\n"
+    "    --limit=M           stop after M records\n"
+    "    --grep=NEEDLE       only decode the records whose bytes contain NEEDLE, which is hex:BYTES, like hex:0a1b,\n"
+    "                        tbcd:DIGITS for a number like an IMSI or MSISDN, or text:TEXT, or just TEXT\n"
+    "\n"
+    "       decoder ASN1FILE... --batch=DIR TYPENAME [--jobs=N] [--output-dir=DIR]\n"
+    "\n"
+    "    Decodes every file in DIR, or if DIR is -, every file listed on stdin, with the schema parsed only once.\n"
+    "    N files are decoded at a time, by default as many as there are cores. The outputs are printed in the order of\n"
+    "    the files, or with --output-dir, written to a FILE.txt for each. A file that fails doesn't stop the others\n"
+    "\n"
+    "       decoder ASN1FILE... --watch=DIR TYPENAME [--journal=FILE]\n"
+    "\n"
+    "    Decodes the files in DIR, and then each file that is written to it, when it is closed. How far it got in each\n"
+    "    file is kept in FILE, by default DIR/.decoder-journal, so when it is started again, it goes on from there\n"
+    "\n"
+    "       decoder ASN1FILE... BINARY TYPENAME --follow [--poll=MS]\n"
+    "\n"
+    "    Decodes BINARY while it is being written, like tail -f. Each record is printed once all of it is there, and\n"
+    "    only what is appended is read. It looks for more at least every MS milliseconds, by default 1000\n"
+    "\n"
+    "       decoder ASN1FILE... --serve=SOCKET [--jobs=N]\n"
+    "       decoder --connect=SOCKET BINARY TYPENAME [--validate]\n"
+    "\n"
+    "    --serve keeps the schema loaded, and decodes what clients send to the unix socket SOCKET, N at a time.\n"
+    "    --connect is such a client. BINARY can be - for stdin, which is sent to the server, otherwise only its path is\n"
+    "    sent, and the server reads the file with its own permissions. Only the user running the server can connect\n"
+    "\n"
+    "       decoder --compile-schema ASN1FILE... -o SCHEMAFILE [-t TYPENAME]... [--contains=PATH=TYPE]... [--display-hints=FILE]...\n"
+    "\n"
+    "    Compiles the ASN1 files into a schema file that loads much faster, and can be given instead of them.\n"
+    "    It is compiled again by itself when any of the ASN1 files change.\n"
+    "    With -t, only the types reachable from the given types are kept\n"
+  );
+}
+
+static int is_option(const char *str) {
+  return str[0] == '-' && str[1] == '-';
+}
+
+/* The number in the value of option, which must be at least min */
+static i64 option_number(const char *option, const char *value, i64 min) {
+  char *end;
+  long long n;
+
+  n = strtoll(value, &end, 10);
+  if (*end || end == value || n < min) {
+    fprintf(stderr, "Expected a number of at least %"PRId64 " in %s\n", min, option);
+    exit(1);
+  }
+  return n;
+}
+
+static void print_schema_stats(FILE *f, SchemaStats *before, SchemaStats *after) {
+  fprintf(f, "Kept %i of %i types, %i of %i type nodes and %i of %i tags\n",
+    after->types, before->types, after->nodes, before->nodes, after->tags, before->tags);
+}
+
+/* Applies the PATH=TYPE arguments to the schema */
+static void schema_contains(Array(ASN1_Typedef) types, Array(const char*) contains) {
+  const char **arg, *eq;
+  char *path;
+  int n;
+
+  array_foreach(contains, arg) {
+    eq = strrchr(*arg, '=');
+    if (!eq || eq == *arg || !eq[1]) {
+      fprintf(stderr, "Expected PATH=TYPE, but got '%s'\n", *arg);
+      exit(1);
+    }
+    path = malloc(eq - *arg + 1);
+    memcpy(path, *arg, eq - *arg);
+    path[eq - *arg] = 0;
+
+    n = asn1_contains_set(types, path, eq+1);
+    if (n < 0) {
+      fprintf(stderr, "Found no type '%s' in definition\n", eq+1);
+      exit(1);
+    }
+    if (n == 0) {
+      fprintf(stderr, "Found no OCTET STRING or BIT STRING field '%s' in definition\n", path);
+      exit(1);
+    }
+    free(path);
+  }
+}
+
+static const char *display_names[] = {"guess", "ip", "time", "tbcd", "integer", "hex", "text"};
+
+/* Sets how the fields are shown, from a file with lines like
+ *
+ *   Record.call.startTime  time
+ *   servedMSISDN           tbcd
+ *
+ * where the first word is a field path like for --contains, and the second is one of display_names */
+static void schema_display_hints(Array(ASN1_Typedef) types, const char *filename) {
+  char line[1024], path[512], kind[32];
+  Array(Tag*) fields;
+  Tag **field;
+  ASN1_Type *string;
+  FILE *f;
+  int line_number, display, n;
+
+  f = fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "Could not find file '%s': %s\n", filename, strerror(errno));
+    exit(1);
+  }
+
+  for (line_number = 1; fgets(line, sizeof(line), f); ++line_number) {
+    if (strstr(line, "--"))
+      *strstr(line, "--") = 0;
+    n = sscanf(line, "%511s %31s", path, kind);
+    if (n <= 0)
+      continue;
+
+    for (display = 0; display < (int)(sizeof(display_names)/sizeof(*display_names)); ++display)
+      if (n == 2 && !strcmp(kind, display_names[display]))
+        break;
+    if (display == sizeof(display_names)/sizeof(*display_names)) {
+      fprintf(stderr, "%s:%i: Expected a field and one of guess, ip, time, tbcd, integer, hex or text\n", filename, line_number);
+      exit(1);
+    }
+
+    n = 0;
+    fields = asn1_fields_find(types, path);
+    array_foreach(fields, field) {
+      string = asn1_field_string(*field);
+      if (string)
+        string->primitive.display = display, ++n;
+    }
+    array_free(fields);
+    if (!n) {
+      fprintf(stderr, "%s:%i: Found no OCTET STRING or BIT STRING field '%s' in definition\n", filename, line_number, path);
+      exit(1);
+    }
+  }
+  fclose(f);
+}
+
+/* Parses the ASN1 files, and sets which fields hold encoded types and how they are shown */
+static Array(ASN1_Typedef) schema_parse(const char **files, int num_files, SchemaOptions *options) {
+  Array(ASN1_Typedef) types;
+  Array(Tag*) fields;
+  Tag **field;
+  const char **hints;
+
+  types = asn1_parse(files, num_files);
+  if (!types)
+    return 0;
+
+  /* polystar special sauce: without anything saying otherwise, cdrData holds an XDR-TYPE */
+  if (!options->contains && asn1_find_type(types, "XDR-TYPE"))
+    asn1_contains_set(types, "cdrData", "XDR-TYPE");
+  schema_contains(types, options->contains);
+
+  /* string fields with ip in their name hold ip addresses, unless the hints say otherwise */
+  fields = asn1_fields_find(types, 0);
+  array_foreach(fields, field)
+    if (type_is_string((*field)->type) && strstri("ip", (*field)->name))
+      asn1_field_string(*field)->primitive.display = DISPLAY_IP;
+  array_free(fields);
+  array_foreach(options->display_hints, hints)
+    schema_display_hints(types, *hints);
+
+  return types;
+}
+
+static int compile_schema(int argc, const char **argv) {
+  Array(const char*) files = 0;
+  SchemaOptions options = {0};
+  Array(ASN1_Typedef) types;
+  SchemaStats before, after;
+  const char *output = 0;
+  int i;
+
+  for (i = 0; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+      output = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc)
+      array_push(options.roots, argv[++i]);
+    else if (strncmp(argv[i], "--contains=", 11) == 0)
+      array_push(options.contains, argv[i] + 11);
+    else if (strncmp(argv[i], "--display-hints=", 16) == 0)
+      array_push(options.display_hints, argv[i] + 16);
+    else if (!is_option(argv[i]))
+      array_push(files, argv[i]);
+  }
+  if (!output || !array_len(files))
+    print_usage(), exit(1);
+
+  types = schema_parse(files, array_len(files), &options);
+  for (i = 0; i < array_len(options.roots); ++i)
+    if (!asn1_find_type(types, options.roots[i])) {
+      fprintf(stderr, "Found no type '%s' in definition\n", options.roots[i]);
+      exit(1);
+    }
+  if (options.roots) {
+    types = asn1_prune(types, options.roots, array_len(options.roots), &before, &after);
+    print_schema_stats(stdout, &before, &after);
+  }
+
+  if (asn1_schema_save(types, asn1_parsed_files(), array_len(asn1_parsed_files()), &options, output)) {
+    fprintf(stderr, "Failed to write %s: %s\n", output, strerror(errno));
+    exit(1);
+  }
+  printf("Compiled %i types into %s\n", (int)array_len(types), output);
+  return 0;
+}
+
+/* Parses the ASN1 files, unless we were given a compiled schema. given has the --contains and --display-hints options */
+static Array(ASN1_Typedef) schema_load(const char **files, int num_files, SchemaOptions *given) {
+  Array(ASN1_Typedef) types;
+  Array(char*) sources = 0;
+  SchemaOptions options = {0};
+  SchemaStats before, after;
+  const char **hints;
+
+  if (num_files != 1 || !asn1_schema_is_compiled(files[0]))
+    return schema_parse(files, num_files, given);
+
+  types = asn1_schema_load(files[0], &sources, &options);
+  if (!types) {
+    /* the sources changed, so compile it again, the same way as before */
+    types = schema_parse((const char**)sources, array_len(sources), &options);
+    if (options.roots)
+      types = asn1_prune(types, options.roots, array_len(options.roots), &before, &after);
+    if (asn1_schema_save(types, asn1_parsed_files(), array_len(asn1_parsed_files()), &options, files[0]))
+      fprintf(stderr, "Failed to update %s: %s\n", files[0], strerror(errno));
+  }
+
+  /* these come on top of what it was compiled with */
+  schema_contains(types, given->contains);
+  array_foreach(given->display_hints, hints)
+    schema_display_hints(types, *hints);
+  return types;
+}
+
+static ASN1_Typedef *get_type_by_name(const char *name) {
+  return asn1_find_type(Global.types, name);
+}
+
+#define MIN(a,b) ((b) < (a) ? (b) : (a))
+#define MAX(a,b) ((a) < (b) ? (b) : (a))
+
+static int type_is_primitive(ASN1_Type *type) {
+  switch (type->type) {
+    case TYPE_UNKNOWN:
+    case TYPE_NULL:
+    case TYPE_SEQUENCE:
+    case TYPE_CHOICE:
+    case TYPE_LIST:
+    case _TYPE_REFERENCE:
+      return 0;
+    case TYPE_BOOLEAN:
+    case TYPE_ENUM:
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING:
+    case TYPE_UTF8_STRING:
+    case TYPE_IA5_STRING:
+    case TYPE_PRINTABLE_STRING:
+    case TYPE_INTEGER:
+      return 1;
+  }
+  return 0;
+}
+
+static int type_is_compound(ASN1_Type *type) {
+  switch (type->type) {
+    case TYPE_UNKNOWN:
+    case TYPE_NULL:
+    case _TYPE_REFERENCE:
+    case TYPE_BOOLEAN:
+    case TYPE_ENUM:
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING:
+    case TYPE_UTF8_STRING:
+    case TYPE_IA5_STRING:
+    case TYPE_PRINTABLE_STRING:
+    case TYPE_INTEGER:
+      return 0;
+    case TYPE_SEQUENCE:
+    case TYPE_CHOICE:
+    case TYPE_LIST:
+      return 1;
+  }
+  return 0;
+}
+
+/* The first child of an object, or -1 if it has none */
+static int object_first_child(int i) {
+  return Global.objects[i].end > i+1 ? i+1 : -1;
+}
+
+/* The next sibling of an object, or -1 if it is the last one */
+static int object_next_sibling(int i) {
+  int parent;
+
+  parent = Global.objects[i].parent;
+  if (parent < 0 || Global.objects[i].end >= Global.objects[parent].end)
+    return -1;
+  return Global.objects[i].end;
+}
+
+/* The previous sibling of an object, or -1 if it is the first one */
+static int object_prev_sibling(int i) {
+  int c, prev = -1;
+
+  if (Global.objects[i].parent < 0)
+    return -1;
+  for (c = Global.objects[i].parent+1; c < i; c = Global.objects[c].end)
+    prev = c;
+  return prev;
+}
+
+/* The last child of an object, or -1 if it has none */
+static int object_last_child(int i) {
+  int c, last = -1;
+
+  for (c = object_first_child(i); c != -1; c = object_next_sibling(c))
+    last = c;
+  return last;
+}
+
+/* Whether the object is a string holding an encoded type that --lazy-contents has not decoded yet */
+static int object_is_unexpanded(Object *object) {
+  return type_is_string(object->type) && object->type->primitive.contains;
+}
+
+/* Decodes the type in an unexpanded string, and replaces the string with it */
+static void object_expand_contents(int i) {
+  Object *subtree;
+  unsigned char *data;
+  int decoded, n, grow, j;
+
+  data = Global.data;
+  Global.data = Global.objects[i].data.string.value;
+  decoded = decode(Global.objects[i].type->primitive.contains, Global.objects[i].name, Global.objects[i].item, 0, Global.data + Global.objects[i].data.string.len, 0);
+  Global.data = data;
+  if (decoded < 0)
+    return;
+
+  /* the decoded subtree was put at the end, so take it out, and renumber it to where the string is */
+  n = array_len(Global.objects) - decoded;
+  grow = n-1;
+  subtree = malloc(n * sizeof(*subtree));
+  memcpy(subtree, Global.objects + decoded, n * sizeof(*subtree));
+  array_resize(Global.objects, decoded);
+  for (j = 0; j < n; ++j) {
+    subtree[j].end += i - decoded;
+    subtree[j].parent = j ? subtree[j].parent + i - decoded : Global.objects[i].parent;
+  }
+
+  /* and make room for it, by moving everything after the string */
+  for (j = 0; j < decoded; ++j) {
+    if (Global.objects[j].end > i)
+      Global.objects[j].end += grow;
+    if (Global.objects[j].parent > i)
+      Global.objects[j].parent += grow;
+  }
+  array_push_n(Global.objects, grow);
+  memmove(Global.objects + i + n, Global.objects + i + 1, (decoded - i - 1) * sizeof(*subtree));
+  memcpy(Global.objects + i, subtree, n * sizeof(*subtree));
+  free(subtree);
+
+  if (Global.collapsed) {
+    array_push_n(Global.collapsed, grow);
+    memmove(Global.collapsed + i + n, Global.collapsed + i + 1, decoded - i - 1);
+    memset(Global.collapsed + i + 1, 0, grow);
+  }
+  if (Global.current_object > i)
+    Global.current_object += grow;
+}
+
+static u64 octet_to_int(Object *object) {
+  u64 val = 0;
+  int i;
+  for (i = 0; i < object->data.string.len; ++i)
+    val <<= 8, val |= object->data.string.value[i];
+  return val;
+}
+
+/* The name of an ENUMERATED value, or of an INTEGER with named numbers. 0 if it has none */
+static const char *integer_name(Object *object) {
+  if (!object->type->primitive.names)
+    return 0;
+  return asn1_name_lookup(object->type->primitive.names, (long long)object->data.integer.value);
+}
+
+/* The names of the set bits in a BIT STRING with named bits, like "{a, c}" */
+static const char *bit_string_names(Object *object) {
+  static char result[256];
+  unsigned char *bits;
+  const char *name, *separator;
+  i64 num_bits, i;
+  int n;
+
+  bits = object->data.string.value;
+  num_bits = object->data.string.len ? (object->data.string.len-1)*8 - bits[0] : 0;
+
+  n = sprintf(result, "{");
+  for (i = 0; i < num_bits; ++i) {
+    if (!(bits[1 + i/8] & (0x80 >> (i%8))))
+      continue;
+
+    separator = n > 1 ? ", " : "";
+    name = asn1_name_lookup(object->type->primitive.names, i);
+    if (name)
+      n += snprintf(result+n, sizeof(result)-n, "%s%s", separator, name);
+    else
+      n += snprintf(result+n, sizeof(result)-n, "%sbit %"PRId64, separator, i);
+
+    if (n >= (int)sizeof(result)-1) {
+      strcpy(result + sizeof(result) - 5, "...}");
+      return result;
+    }
+  }
+  strcpy(result+n, "}");
+  return result;
+}
+
+/* Whether every byte is printable ASCII, from ' ' to '~'. 8 bytes are checked at a time */
+static int octet_is_printable(Object *object) {
+  const u64 ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+  unsigned char *p, *end;
+  u64 x;
+
+  p = object->data.string.value;
+  end = p + object->data.string.len;
+  for (; end - p >= 8; p += 8) {
+    memcpy(&x, p, 8);
+    /* the high bit of a byte ends up set if it is below ' ', or above '~' */
+    if (((x - ones*' ') & ~x & highs) || ((x + ones*(127-'~')) | x) & highs)
+      return 0;
+  }
+  for (; p < end; ++p)
+    if (*p < ' ' || *p > '~')
+      return 0;
+  return 1;
+}
+
+/* Two hex digits for each byte value */
+static char hex_table[512];
+
+/* The bytes of a string as hex digits, or only the first 20 of them, unless --full-values was given */
+static const char *octet_to_hex(Object *object, int *truncated) {
+  static Array(char) hex;
+  i64 i, n;
+
+  if (!hex_table[0]) {
+    for (i = 0; i < 256; ++i) {
+      hex_table[2*i] = "0123456789abcdef"[i >> 4];
+      hex_table[2*i+1] = "0123456789abcdef"[i & 0xf];
+    }
+  }
+
+  n = object->data.string.len;
+  *truncated = !Global.full_values && n > 20;
+  if (*truncated)
+    n = 20;
+
+  array_resize(hex, 2*n+1);
+  for (i = 0; i < n; ++i)
+    memcpy(hex + 2*i, hex_table + 2*object->data.string.value[i], 2);
+  hex[2*n] = 0;
+  return hex;
+}
+
+/* Whether milliseconds since 1970 are recent enough to guess that they are a time.
+ * The window is taken from when the first value was checked, which is close enough for a run */
+static int time_is_plausible(u64 val) {
+  static time_t min, max;
+  time_t t, now;
+
+  if (!max) {
+    now = time(0);
+    /* 3 years old or 1 day in future is ok */
+    min = now - 60*60*24*365*3;
+    max = now + 60*60*24;
+  }
+
+  t = val/1000;
+  return t > min && t < max;
+}
+
+/* Formats milliseconds since 1970 as a local time, like 2017-03-01 12:34:56.078
+ * Times tend to be on the same few days, so the date of the last day seen is kept,
+ * and only the time within the day is worked out for times on it */
+static char* int_to_time(u64 val) {
+  static char date[32];
+  static time_t day_begin, day_end;
+  struct tm *tm_time, next_day;
+  time_t t;
+  int secs;
+
+  t = val/1000;
+
+  if (t < day_begin || t >= day_end) {
+    tm_time = localtime(&t);
+    if (!tm_time)
+      return 0;
+    strftime(date, sizeof(date)-1, "%Y-%m-%d ", tm_time);
+    day_begin = t - (tm_time->tm_hour*60*60 + tm_time->tm_min*60 + tm_time->tm_sec);
+
+    next_day = *tm_time;
+    next_day.tm_mday += 1;
+    next_day.tm_hour = next_day.tm_min = next_day.tm_sec = 0;
+    next_day.tm_isdst = -1;
+    day_end = mktime(&next_day);
+
+    /* the clocks change on this day, so the time within it can't just be counted from midnight */
+    if (day_end - day_begin != 60*60*24) {
+      day_begin = day_end = 0;
+      strftime(date, sizeof(date)-1, "%Y-%m-%d %H:%M:%S", tm_time);
+      sprintf(date+19, ".%.3u", (unsigned)(val % 1000));
+      return date;
+    }
+  }
+
+  secs = (int)(t - day_begin);
+  sprintf(date+11, "%.2i:%.2i:%.2i.%.3u", secs/3600, secs/60%60, secs%60, (unsigned)(val % 1000));
+  return date;
+}
+
+/* For each byte of TBCD, its digits, low nibble first. A nibble of 0xf is filler and has no digit.
+ * num_digits is -1 if either nibble is not a digit */
+static struct {
+  char digits[2];
+  signed char num_digits;
+} tbcd_table[256];
+
+static void tbcd_table_init(void) {
+  int c, lo, hi;
+
+  for (c = 0; c < 256; ++c) {
+    lo = c & 0xf, hi = c >> 4;
+    tbcd_table[c].num_digits = 0;
+    if ((lo > 9 && lo != 0xf) || (hi > 9 && hi != 0xf)) {
+      tbcd_table[c].num_digits = -1;
+      continue;
+    }
+    if (lo != 0xf)
+      tbcd_table[c].digits[tbcd_table[c].num_digits++] = '0'+lo;
+    if (hi != 0xf)
+      tbcd_table[c].digits[tbcd_table[c].num_digits++] = '0'+hi;
+  }
+}
+
+/* The digits of a TBCD string, like an MSISDN or IMSI, or 0 if it isn't one */
+static char* octet_to_numberstring(Object *object) {
+  static Array(char) number;
+  unsigned char *value;
+  i64 i, n, len;
+
+  /* a zero byte is two digits, once the table is filled in */
+  if (!tbcd_table[0].num_digits)
+    tbcd_table_init();
+
+  len = object->data.string.len;
+  value = object->data.string.value;
+  array_resize(number, 2*len+1);
+
+  for (i = 0, n = 0; i < len; ++i) {
+    if (tbcd_table[value[i]].num_digits < 0)
+      return 0;
+    memcpy(number+n, tbcd_table[value[i]].digits, 2);
+    n += tbcd_table[value[i]].num_digits;
+  }
+  number[n] = 0;
 
   return number;
 }
 
+/* How to show an OCTET or BIT STRING, from the display kind of its field, and if that is DISPLAY_GUESS, what the value looks like.
+ * For DISPLAY_TIME and DISPLAY_TBCD, str is set to the formatted value */
+static int octet_display(Object *object, const char **str) {
+  i64 len;
+
+  len = object->data.string.len;
+  switch (object->type->primitive.display) {
+    case DISPLAY_IP:
+      /* TODO: ipv6 */
+      if (len == 4)
+        return DISPLAY_IP;
+      break;
+    case DISPLAY_TIME:
+      if (len > 8)
+        return DISPLAY_HEX;
+      *str = int_to_time(octet_to_int(object));
+      return DISPLAY_TIME;
+    case DISPLAY_TBCD:
+      *str = octet_to_numberstring(object);
+      return *str ? DISPLAY_TBCD : DISPLAY_HEX;
+    case DISPLAY_INTEGER:
+      return len <= 8 ? DISPLAY_INTEGER : DISPLAY_HEX;
+    case DISPLAY_TEXT:
+      return octet_is_printable(object) ? DISPLAY_TEXT : DISPLAY_HEX;
+    case DISPLAY_HEX:
+      return DISPLAY_HEX;
+  }
+
+  /* if it's small, it might be something special */
+  if (len <= 8) {
+    u64 val = octet_to_int(object);
+
+    /* could it be a timestamp ? */
+    if (time_is_plausible(val)) {
+      *str = int_to_time(val);
+      return DISPLAY_TIME;
+    }
+
+    /* could it be a numberstring? */
+    *str = octet_to_numberstring(object);
+    if (*str)
+      return DISPLAY_TBCD;
+
+    /* otherwise just show it as a number */
+    return DISPLAY_INTEGER;
+  }
+
+  /* is it printable as a string? */
+  if (octet_is_printable(object))
+    return DISPLAY_TEXT;
+
+  /* otherwise show it as hex */
+  return DISPLAY_HEX;
+}
+
+
+
+
+/** PUSH DECODER **/
+
+/* A decoder that is fed bytes as they arrive, instead of pulling them from Global.data.
+ * Open elements are kept on an explicit stack instead of the C stack, so it can stop anywhere,
+ * even in the middle of a header, and carry on when more bytes are fed.
+ * It decodes the same way as decode(), constraints included, but reports the tree as a series of events */
+
+typedef enum {
+  PUSH_START, /* a SEQUENCE, SEQUENCE OF or CHOICE starts */
+  PUSH_VALUE, /* a primitive value */
+  PUSH_END    /* the innermost started SEQUENCE, SEQUENCE OF or CHOICE ends */
+} PushEventType;
+
+typedef struct {
+  PushEventType event;
+  ASN1_Type *type;
+  const char *name;
+  /* for items in a SEQUENCE OF, the item number starting at 1, otherwise 0 */
+  int item;
+  int depth;
+  /* stream offset of the element */
+  u64 offset;
+  /* for PUSH_VALUE, the contents. Only valid during the callback */
+  const unsigned char *value;
+  i64 len;
+} PushEvent;
+
+typedef void (*PushCallback)(PushEvent *event, void *userdata);
+
+#define PUSH_INDEFINITE ((u64)-1)
+
+typedef struct {
+  ASN1_Type *type;
+  const char *name;
+  int item;
+  /* stream offset where the contents end, or PUSH_INDEFINITE */
+  u64 end;
+  /* for SEQUENCE, the first tag that can come next */
+  Tag *next;
+  int num_items;
+  /* if set, this frame read the length of the element, so it is the one that skips the end-of-contents */
+  char owns_eoc;
+} PushFrame;
+
+typedef struct {
+  ASN1_Typedef *start_type;
+  PushCallback callback;
+  void *userdata;
+
+  Array(PushFrame) stack;
+  /* stream offset of the next byte to be processed */
+  u64 offset;
+
+  /* set while waiting for the contents of a primitive value */
+  int in_value;
+  PushEvent value_event;
+
+  /* the start of a header or value that was split between two feeds */
+  Array(unsigned char) pending;
+
+  char error[128];
+} PushDecoder;
+
+static void push_init(PushDecoder *d, ASN1_Typedef *start_type, PushCallback callback, void *userdata) {
+  memset(d, 0, sizeof(*d));
+  d->start_type = start_type;
+  d->callback = callback;
+  d->userdata = userdata;
+}
+
+static void push_free(PushDecoder *d) {
+  array_free(d->stack);
+  array_free(d->pending);
+}
+
+static int push_fail(PushDecoder *d, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(d->error, sizeof(d->error), fmt, args);
+  va_end(args);
+  return -1;
+}
+
+static void push_emit(PushDecoder *d, PushEventType event, ASN1_Type *type, const char *name, int item, u64 offset) {
+  PushEvent e;
+  e.event = event;
+  e.type = type;
+  e.name = name;
+  e.item = item;
+  e.depth = array_len(d->stack);
+  e.offset = offset;
+  e.value = 0;
+  e.len = 0;
+  d->callback(&e, d->userdata);
+}
+
+static void push_frame(PushDecoder *d, ASN1_Type *type, const char *name, int item, u64 end, int owns_eoc) {
+  PushFrame f;
+  f.type = type;
+  f.name = name;
+  f.item = item;
+  f.end = end;
+  f.next = type->type == TYPE_SEQUENCE ? type->sequence.items : 0;
+  f.num_items = 0;
+  f.owns_eoc = owns_eoc;
+  array_push(d->stack, f);
+}
+
+/* Checks a SIZE or range constraint like decode() does, at stream offset pos. Returns -1 if it is violated
+ * and violations aren't counted. fits is as given by constraint_value() */
+static int push_constraint_check(PushDecoder *d, Constraint *c, const char *name, int item, long long value, int fits, u64 pos) {
+  char item_name[32];
+
+  if (!c || (fits && constraint_holds(c, value)))
+    return 1;
+  if (item) {
+    sprintf(item_name, "item #%i", item);
+    name = item_name;
+  }
+  if (!Global.count_violations)
+    return push_fail(d, "%s is %lld, which violates its constraint %s", name, value, constraint_to_string(c));
+  constraint_violation_count(c, name, pos);
+  return 1;
+}
+
+/* Ends the innermost element, whose contents ended at stream offset end */
+static int push_pop(PushDecoder *d, u64 end) {
+  PushFrame f;
+  f = *array_last(d->stack);
+  --array_len_get(d->stack);
+  if (f.type->type == TYPE_LIST && push_constraint_check(d, f.type->list.constraint, f.name, f.item, f.num_items, 1, end) < 0)
+    return -1;
+  push_emit(d, PUSH_END, f.type, f.name, f.item, d->offset);
+  return 1;
+}
+
+/* Parses an identifier and length from the n bytes at data.
+ * Returns the size of the header, 0 if more bytes are needed, or -1 if it is malformed */
+static int ber_header_parse(const unsigned char *data, i64 n, BerIdentifier *bi, i64 *len) {
+  int i = 0, num_bytes;
+
+  if (n < 2)
+    return 0;
+
+  bi->class = (data[0] & 0xC0) >> 6;
+  bi->pc = !!(data[0] & 0x20);
+  bi->tag_number = data[0] & 0x1f;
+  ++i;
+  if (bi->tag_number == 0x1f) {
+    bi->tag_number = 0;
+    do {
+      if (i >= n)
+        return 0;
+      if (i > (int)sizeof(int))
+        return -1;
+      bi->tag_number = (bi->tag_number << 7) | (data[i] & 0x7f);
+    } while (data[i++] & 0x80);
+  }
+
+  if (i >= n)
+    return 0;
+  *len = data[i++];
+  if (!(*len & 0x80))
+    return i;
+  if (*len == 0xFF)
+    return -1;
+  if (*len == 0x80) {
+    *len = LENGTH_INDEFINITE;
+    return i;
+  }
+
+  num_bytes = *len & 0x7F;
+  if (num_bytes > (int)sizeof(i64) - 1)
+    return -1;
+  if (n - i < num_bytes)
+    return 0;
+  for (*len = 0; num_bytes--;)
+    *len = (*len << 8) | data[i++];
+  return i;
+}
+
+/* Starts an element whose header has been read. Its contents end at end */
+static int push_element(PushDecoder *d, ASN1_Type *type, const char *name, int item, BerIdentifier bi, i64 len, u64 offset, u64 end, int owns_eoc) {
+  /* the contents are decoded as the type encoded in the string, which is itself primitive.
+   * The size of an OCTET STRING is known from its length, but a BIT STRING needs its first byte, so only the former is checked here */
+  if ((type->type == TYPE_OCTET_STRING || type->type == TYPE_BIT_STRING) && type->primitive.contains) {
+    if (type->type == TYPE_OCTET_STRING && push_constraint_check(d, type->primitive.constraint, name, item, len, 1, d->offset) < 0)
+      return -1;
+    type = type->primitive.contains;
+    bi.pc = BER_CONSTRUCTED;
+  }
+
+  if (type_is_primitive(type)) {
+    if (len == LENGTH_INDEFINITE)
+      return push_fail(d, "Indefinite length on primitive %s", name);
+    d->in_value = 1;
+    d->value_event.event = PUSH_VALUE;
+    d->value_event.type = type;
+    d->value_event.name = name;
+    d->value_event.item = item;
+    d->value_event.depth = array_len(d->stack);
+    d->value_event.offset = offset;
+    d->value_event.len = len;
+    return 1;
+  }
+
+  if (!type_is_compound(type))
+    return push_fail(d, "Type of %s not supported", name);
+  if (bi.pc != BER_CONSTRUCTED)
+    return push_fail(d, "%s should be constructed, but is primitive", name);
+
+  push_emit(d, PUSH_START, type, name, item, offset);
+  push_frame(d, type, name, item, end, owns_eoc);
+  return 1;
+}
+
+/* A header was read at the top level, or as the value of a CHOICE. The element picks the alternative */
+static int push_choice_element(PushDecoder *d, ASN1_Type *type, const char *name, BerIdentifier bi, i64 len, u64 offset, u64 end, int owns_eoc) {
+  Tag *tag;
+
+  tag = ber_find_matching_tag(type->choice.choices, array_len(type->choice.choices), bi);
+  if (!tag)
+    return push_fail(d, "For CHOICE %s, BER tag number was %i, but no such choice exists", name, bi.tag_number);
+  return push_element(d, tag->type, tag->name, 0, bi, len, offset, end, owns_eoc);
+}
+
+/* Does one thing: finishes a value, ends an element, or reads a header.
+ * Returns 1 if it did something, 0 if it needs more bytes than the n at data, or -1 on error.
+ * *used is set to the number of bytes it used, which can be 0 even if it did something */
+static int push_step(PushDecoder *d, const unsigned char *data, i64 n, i64 *used) {
+  PushFrame *f;
+  BerIdentifier bi;
+  u64 end, offset;
+  long long value;
+  i64 len;
+  int header_size, fits;
+
+  *used = 0;
+
+  if (d->in_value) {
+    if (n < d->value_event.len)
+      return 0;
+    d->in_value = 0;
+    d->value_event.value = data;
+    if ((d->value_event.type->type == TYPE_INTEGER || d->value_event.type->type == TYPE_ENUM) && d->value_event.len > 8)
+      return push_fail(d, "%s is %"PRId64 " bytes long, which is more than 8", d->value_event.name, d->value_event.len);
+    if (d->value_event.type->primitive.constraint) {
+      value = constraint_value(d->value_event.type, (unsigned char*)data, d->value_event.len, &fits);
+      if (push_constraint_check(d, d->value_event.type->primitive.constraint, d->value_event.name, d->value_event.item, value, fits, d->offset) < 0)
+        return -1;
+    }
+    d->callback(&d->value_event, d->userdata);
+    *used = d->value_event.len;
+    d->offset += *used;
+    return 1;
+  }
+
+  /* does the innermost element end here? */
+  f = array_len(d->stack) ? array_last(d->stack) : 0;
+  if (f && f->end != PUSH_INDEFINITE) {
+    if (d->offset == f->end)
+      return push_pop(d, d->offset);
+    if (d->offset > f->end)
+      return push_fail(d, "%s went past its end by %"PRIu64 " bytes", f->name, d->offset - f->end);
+  }
+  else if (f) {
+    if (n < 2)
+      return 0;
+    if (data[0] == 0 && data[1] == 0) {
+      end = d->offset;
+      if (f->owns_eoc) {
+        *used = 2;
+        d->offset += 2;
+      }
+      return push_pop(d, end);
+    }
+  }
+
+  header_size = ber_header_parse(data, n, &bi, &len);
+  if (header_size == 0)
+    return 0;
+  if (header_size < 0)
+    return push_fail(d, "Malformed identifier or length");
+
+  offset = d->offset;
+  d->offset += header_size;
+  *used = header_size;
+  end = len == LENGTH_INDEFINITE ? PUSH_INDEFINITE : d->offset + len;
+  if (f && f->end != PUSH_INDEFINITE && end != PUSH_INDEFINITE && end > f->end)
+    return push_fail(d, "Length %"PRId64 " exceeds the %"PRIu64 " bytes left in %s", len, f->end - d->offset, f->name);
+
+  /* top level */
+  if (!f) {
+    if (d->start_type->type->type == TYPE_CHOICE) {
+      /* the record is the CHOICE element itself */
+      push_emit(d, PUSH_START, d->start_type->type, d->start_type->name, 0, offset);
+      push_frame(d, d->start_type->type, d->start_type->name, 0, end, 1);
+      array_last(d->stack)->num_items = 1;
+      return push_choice_element(d, d->start_type->type, d->start_type->name, bi, len, offset, end, 0);
+    }
+    return push_element(d, d->start_type->type, d->start_type->name, 0, bi, len, offset, end, 1);
+  }
+
+  switch (f->type->type) {
+    case TYPE_SEQUENCE: {
+      Tag *tag;
+
+      tag = ber_find_matching_tag(f->next, array_end(f->type->sequence.items) - f->next, bi);
+      if (!tag)
+        return push_fail(d, "Unable to find matching tag in %s for ber identifier (%i, %i, %i)", f->name, bi.class, bi.pc, bi.tag_number);
+
+      /* check that we didn't skip any non-optionals */
+      for (; f->next < tag; ++f->next)
+        if (!isset(f->next->flags, TAG_FLAG_OPTIONAL))
+          return push_fail(d, "Tag %s skips over non-optional tag %s", tag->name, f->next->name);
+      f->next = tag+1;
+
+      return push_element(d, tag->type, tag->name, 0, bi, len, offset, end, 1);
+    }
+
+    case TYPE_LIST:
+      if (f->num_items == INT_MAX)
+        return push_fail(d, "%s has more than %i items", f->name, INT_MAX);
+      ++f->num_items;
+      return push_element(d, f->type->list.item_type, f->name, f->num_items, bi, len, offset, end, 1);
+
+    case TYPE_CHOICE:
+      if (f->num_items++)
+        return push_fail(d, "CHOICE %s has more than one value", f->name);
+      return push_choice_element(d, f->type, f->name, bi, len, offset, end, 1);
+
+    default:
+      return push_fail(d, "Unexpected error");
+  }
+}
+
+/* Feeds the next n bytes of the stream. Returns 0 on error, with the reason in d->error */
+static int push_feed(PushDecoder *d, const unsigned char *data, i64 n) {
+  i64 used, take;
+  int r;
+
+  if (d->error[0])
+    return 0;
+
+  /* first finish what was split at the end of the last feed.
+   * Headers are short, so we move bytes over one at a time until they parse */
+  while (array_len(d->pending)) {
+    r = push_step(d, d->pending, array_len(d->pending), &used);
+    if (r < 0)
+      return 0;
+    if (r > 0) {
+      array_remove_slow_n(d->pending, 0, used);
+      continue;
+    }
+    if (!n)
+      return 1;
+    take = d->in_value ? MIN(n, d->value_event.len - array_len(d->pending)) : 1;
+    array_push_a(d->pending, data, take);
+    data += take, n -= take;
+  }
+
+  /* then work directly on the new bytes */
+  while ((r = push_step(d, data, n, &used)) > 0)
+    data += used, n -= used;
+  if (r < 0)
+    return 0;
+
+  /* and keep what's left until next time */
+  array_push_a(d->pending, data, n);
+  return 1;
+}
+
+/* Call at the end of the stream. Returns 0 if it ended in the middle of a record */
+static int push_finish(PushDecoder *d) {
+  if (d->error[0])
+    return 0;
+  if (array_len(d->stack) || d->in_value || array_len(d->pending)) {
+    push_fail(d, "Unexpected end of input stream");
+    return 0;
+  }
+  return 1;
+}
+
+
+
+
+/** INTERACTIVE MODE **/
+
+#ifdef COMPILE_INTERACTIVE_MODE
+enum {
+  CURSES_GREEN = 1,
+  CURSES_BLUE = 2,
+  CURSES_YELLOW = 3,
+  CURSES_INV = 4
+};
+
+enum {
+  COLOR_FOR_IP = CURSES_BLUE,
+  COLOR_FOR_INT = CURSES_GREEN,
+  COLOR_FOR_TIME = CURSES_BLUE,
+  COLOR_FOR_STRING = CURSES_BLUE,
+  COLOR_FOR_BOOL = CURSES_BLUE,
+  COLOR_FOR_HEX = CURSES_GREEN,
+  COLOR_FOR_SELECTED = CURSES_INV,
+  COLOR_FOR_STATUSBAR = CURSES_INV
+};
+
+static void render_object(WINDOW *window, int i, int x, int x_max, int y);
+static int render_tree(WINDOW *window, int i, int x, int x_max, int *y, int y_max, int *current_object_y);
+
+static void print_help(WINDOW* window) {
+  int y = 2;
+  int w = getmaxx(window);
+
+  erase();
+  mvwprintw(window, y++, w/2 - 9, "##################");
+  mvwprintw(window, y++, w/2 - 9, "#                #");
+  mvwprintw(window, y++, w/2 - 9, "#      HELP      #");
+  mvwprintw(window, y++, w/2 - 9, "#                #");
+  mvwprintw(window, y++, w/2 - 9, "##################");
+  y += 2;
+  mvwprintw(window, y++, w/6, "q  quit");
+  mvwprintw(window, y++, w/6, "?  help");
+  mvwprintw(window, y++, w/6, "=  collapse all siblings");
+  mvwprintw(window, y++, w/6, "e  edit");
+}
+
+static void render_status_bar() {
+  mvwprintw(Global.statusw, 0, 0, "  ?: help   q: quit  e: edit");
+}
+
+typedef enum {
+  MODE_NORMAL,
+  MODE_HELP,
+  MODE_EDIT
+} Mode;
+
+static void edit_init() {
+  int w,h, x,y;
+  if (Global.editw)
+    return;
+
+  getmaxyx(stdscr, h, w);
+
+  y = h/2 - 5;
+  x = w/2 - 15;
+  Global.editw = subwin(Global.objw, 10, 30, y, x);
+  Global.edit_input = subwin(Global.editw, 1, 24, y + 4, x + 3);
+
+  wbkgdset(Global.edit_input, COLOR_PAIR(CURSES_INV));
+  array_resize(Global.edit_buffer, 0);
+}
+
+static void edit_end() {
+  delwin(Global.editw);
+  delwin(Global.edit_input);
+  Global.editw = Global.edit_input = 0;
+}
+
+static void render_edit() {
+  char item_name[32];
+  const char *name;
+  int w, l;
+  Object *o;
+
+  o = Global.objects + Global.current_object;
+
+  werase(Global.editw);
+  werase(Global.edit_input);
+
+  w = getmaxx(Global.editw);
+  box(Global.editw, '|', '-');
+
+  name = object_name(o, item_name);
+  l = strlen(name);
+  mvwprintw(Global.editw, 2, w/2 - l/2, "%s", name);
+
+  wattron(Global.edit_input, COLOR_PAIR(CURSES_INV));
+  mvwprintw(Global.edit_input, 0, 0, "%.*s", (int)array_len(Global.edit_buffer), Global.edit_buffer);
+  wattroff(Global.edit_input, COLOR_PAIR(CURSES_INV));
+}
+
+static void message_box(const char *str) {
+  int w,h, l;
+  WINDOW *win;
+  getmaxyx(stdscr, h, w);
+  l = strlen(str);
+  win = subwin(stdscr, 5, l + 4, h/2 - 3, w/2 - l/2 - 2);
+  werase(win);
+  box(win, '|', '-');
+  mvwprintw(win, 2, 2, "%s", str);
+  wrefresh(win);
+  wgetch(win);
+  delwin(win);
+}
+
+enum {
+  /* the most objects reserved up front from the guess of how many there will be. Past this, the array doubles as usual */
+  INTERACTIVE_RESERVE_MAX = 1 << 22
+};
+
+static void run_interactive(ASN1_Typedef *start_type) {
+  Object *root;
+  Mode mode = MODE_NORMAL;
+  unsigned char *record;
+  double records;
+  i64 estimate;
+  int width, height;
+  int o;
+
+  /* create a fake root */
+  array_push_n(Global.objects, 1);
+  root = Global.objects;
+  memset(root, 0, sizeof(*root));
+  root->parent = -1;
+  root->name = Global.filename;
+  root->type = malloc(sizeof(*root->type));
+  root->type->type = TYPE_LIST;
+  root->type->list.item_type = start_type->type;
+
+  initscr();
+  curs_set(0);
+  start_color();
+  init_pair(CURSES_GREEN, COLOR_GREEN, COLOR_BLACK);
+  init_pair(CURSES_BLUE, COLOR_BLUE, COLOR_BLACK);
+  init_pair(CURSES_YELLOW, COLOR_YELLOW, COLOR_BLACK);
+  init_pair(CURSES_INV, COLOR_BLACK, COLOR_WHITE);
+  getmaxyx(stdscr, height, width);
+
+  Global.objw = newwin(height-1, width, 0, 0);
+  keypad(Global.objw, 1);
+  scrollok(Global.objw, 1);
+
+  Global.statusw = newwin(1, width, height-1, 0);
+  wcolor_set(Global.statusw, COLOR_FOR_STATUSBAR, 0);
+  wbkgdset(Global.statusw, COLOR_PAIR(COLOR_FOR_STATUSBAR));
+
+  while (record_next()) {
+    record = Global.data;
+    o = decode(start_type->type, start_type->name, 0, 0, 0, 0);
+    if (o < 0)
+      break;
+    Global.objects[o].parent = 0;
+
+    /* guess the size of the whole tree from the first record, so it doesn't need to move for every doubling */
+    if (o == 1 && Global.data > record) {
+      records = (double)(array_end(Global.data_begin) - record) / (Global.data - record) / record_selection.every;
+      if (record_selection.sample)
+        records *= record_selection.sample;
+      if (record_selection.limit >= 0 && records > record_selection.limit)
+        records = record_selection.limit;
+      estimate = (i64)MIN((array_len(Global.objects) - o) * records, INTERACTIVE_RESERVE_MAX);
+      array_reserve(Global.objects, 1 + estimate);
+    }
+  }
+  Global.objects[0].end = array_len(Global.objects);
+  array_resize(Global.collapsed, array_len(Global.objects));
+  memset(Global.collapsed, 0, array_len(Global.collapsed));
+  Global.current_object = 0;
+
+  for (;;) {
+    int c, y, y_max, x_max, current_object_y, w,h;
+
+    getmaxyx(stdscr, h, w);
+    if (w != width || h != height) {
+      wresize(Global.objw, h-1, w);
+      mvwin(Global.objw, 0, 0);
+      wresize(Global.statusw, 1, w);
+      mvwin(Global.statusw, h-1, 0);
+      width = w, height = h;
+    }
+
+    werase(Global.objw);
+    werase(Global.statusw);
+
+    getmaxyx(Global.objw, y_max, x_max);
+    y = 0;
+    current_object_y = -1;
+    switch (mode) {
+    case MODE_NORMAL:
+      render_tree(Global.objw, 0, 0, x_max, &y, y_max, &current_object_y);
+      render_status_bar(Global.statusw);
+      break;
+    case MODE_HELP:
+      print_help(Global.objw);
+      break;
+    case MODE_EDIT:
+      render_tree(Global.objw, 0, 0, x_max, &y, y_max, &current_object_y);
+      render_edit();
+      touchwin(Global.objw);
+      render_status_bar(Global.statusw);
+      break;
+    }
+
+    wrefresh(Global.objw);
+    if (Global.editw) {
+      wrefresh(Global.editw);
+      wrefresh(Global.edit_input);
+    }
+    wrefresh(Global.statusw);
+
+    c = wgetch(Global.objw);
+
+    switch (mode) {
+    case MODE_HELP:
+      mode = MODE_NORMAL;
+      break;
+    case MODE_EDIT:
+      if (c == KEY_ENTER || c == 10 || c == 13) {
+        array_push(Global.edit_buffer, 0);
+        Global.objects[Global.current_object].data.integer.value = atol(Global.edit_buffer);/*strtoull(Global.edit_buffer, 0, 10);*/
+        goto end_edit;
+      }
+      else if (c == KEY_BACKSPACE) {
+        if (array_len(Global.edit_buffer) > 0)
+          --array_len_get(Global.edit_buffer);
+      }
+
+      else if (isdigit(c))
+        array_push(Global.edit_buffer, c);
+      else
+        goto end_edit;
+
+      break;
+
+      end_edit:
+      edit_end();
+      mode = MODE_NORMAL;
+      break;
+    case MODE_NORMAL:
+      switch (c) {
+      case 'q':
+        goto done;
+
+      case 'e':
+        if (Global.objects[Global.current_object].type->type != TYPE_INTEGER) {
+          message_box("Editing only supported for integers");
+          break;
+        }
+        edit_init();
+        mode = MODE_EDIT;
+        break;
+
+      case '?':
+        mode = MODE_HELP;
+        break;
+
+      case '=': {
+        int i;
+
+        if (Global.objects[Global.current_object].parent < 0)
+          break;
+        for (i = object_first_child(Global.objects[Global.current_object].parent); i != -1; i = object_next_sibling(i))
+          if (type_is_compound(Global.objects[i].type))
+            Global.collapsed[i] = 1;
+      } break;
+
+      case 'h':
+      case KEY_LEFT: {
+        int i = Global.current_object;
+
+        /* if already collapsed, collaps parent */
+        if ((type_is_primitive(Global.objects[i].type) || Global.collapsed[i]) && Global.objects[i].parent >= 0)
+          Global.current_object = Global.objects[i].parent;
+        else
+          Global.collapsed[i] = 1;
+      } break;
+
+      case 'l':
+      case KEY_RIGHT:
+        if (object_is_unexpanded(Global.objects + Global.current_object))
+          object_expand_contents(Global.current_object);
+        Global.collapsed[Global.current_object] = 0;
+        break;
+
+      case 'k':
+      case KEY_UP: {
+        int i, child;
+
+        i = object_prev_sibling(Global.current_object);
+        if (i == -1) {
+          /* jump to parent */
+          if (Global.objects[Global.current_object].parent >= 0)
+            Global.current_object = Global.objects[Global.current_object].parent;
+          break;
+        }
+
+        /* we go to sibling, and then continue down as far as possible */
+        while (!Global.collapsed[i] && (child = object_last_child(i)) != -1)
+          i = child;
+        Global.current_object = i;
+      } break;
+
+      case 'j':
+      case KEY_DOWN: {
+        int i;
+
+        i = Global.current_object;
+        if (!Global.collapsed[i] && object_first_child(i) != -1) {
+          Global.current_object = object_first_child(i);
+          break;
+        }
+
+        /* find the next sibling, or the next sibling of the closest parent that has one */
+        while (i >= 0 && object_next_sibling(i) == -1)
+          i = Global.objects[i].parent;
+        if (i >= 0)
+          Global.current_object = object_next_sibling(i);
+      } break;
+
+      default:
+        break;
+      }
+      break;
+    }
+    
+  }
+  done:
+  endwin();
+}
+
+static int render_tree(WINDOW* window, int i, int x, int x_max, int *y, int y_max, int *current_object_y) {
+  Object *object;
+  int child;
+  int wy;
 
+  object = Global.objects + i;
 
+  wy = MIN(*y, y_max-1);
 
-/** INTERACTIVE MODE **/
+  /* have we gone at least half a screen past the selected object? */
+  if (*y >= y_max && *current_object_y != -1 && *y - *current_object_y > y_max/2)
+    return 1;
 
-#ifdef COMPILE_INTERACTIVE_MODE
-enum {
-  CURSES_GREEN = 1,
-  CURSES_BLUE = 2,
-  CURSES_YELLOW = 3,
-  CURSES_INV = 4
-};
+  /* if we're not done, scroll down one and keep going */
+  if (*y >= y_max)
+    wscrl(window, 1);
 
-enum {
-  COLOR_FOR_IP = CURSES_BLUE,
-  COLOR_FOR_INT = CURSES_GREEN,
-  COLOR_FOR_TIME = CURSES_BLUE,
-  COLOR_FOR_STRING = CURSES_BLUE,
-  COLOR_FOR_BOOL = CURSES_BLUE,
-  COLOR_FOR_HEX = CURSES_GREEN,
-  COLOR_FOR_SELECTED = CURSES_INV,
-  COLOR_FOR_STATUSBAR = CURSES_INV
-};
+  wmove(window, wy, 0);
+  wclrtoeol(window);
 
-static void render_object(WINDOW *window, Object *object, int x, int x_max, int y);
-static int render_tree(WINDOW *window, Object *objects, int x, int x_max, int *y, int y_max, int *current_object_y);
+  if (type_is_compound(object->type))
+    mvwprintw(window, wy, x, Global.collapsed[i] ? "+" : "-");
+  else if (object_is_unexpanded(object))
+    mvwprintw(window, wy, x, "+");
 
-static void print_help(WINDOW* window) {
-  int y = 2;
-  int w = getmaxx(window);
+  if (i == Global.current_object)
+    *current_object_y = *y;
+  render_object(window, i, x+2, x_max, wy);
 
-  erase();
-  mvwprintw(window, y++, w/2 - 9, "##################");
-  mvwprintw(window, y++, w/2 - 9, "#                #");
-  mvwprintw(window, y++, w/2 - 9, "#      HELP      #");
-  mvwprintw(window, y++, w/2 - 9, "#                #");
-  mvwprintw(window, y++, w/2 - 9, "##################");
-  y += 2;
-  mvwprintw(window, y++, w/6, "q  quit");
-  mvwprintw(window, y++, w/6, "?  help");
-  mvwprintw(window, y++, w/6, "=  collapse all siblings");
-  mvwprintw(window, y++, w/6, "e  edit");
+  ++(*y);
+
+  if (Global.collapsed[i])
+    return 0;
+
+  for (child = object_first_child(i); child != -1; child = object_next_sibling(child))
+    if (render_tree(window, child, x + 2, x_max, y, y_max, current_object_y))
+      return 1;
+  return 0;
 }
 
-static void render_status_bar() {
-  mvwprintw(Global.statusw, 0, 0, "  ?: help   q: quit  e: edit");
+static void render_object(WINDOW *window, int i, int x, int x_max, int y) {
+  /* WARNING: If you make changes here, remember to mirror the changes in dump_object */
+  char item_name[32];
+  Object *object;
+
+  object = Global.objects + i;
+  wmove(window, y, x);
+
+  if (i == Global.current_object)
+    wattron(window, COLOR_PAIR(COLOR_FOR_SELECTED));
+  wprintw(window, "%s", object_name(object, item_name));
+  if (i == Global.current_object)
+    wattroff(window, COLOR_PAIR(COLOR_FOR_SELECTED));
+
+  switch (object->type->type) {
+    case TYPE_CHOICE:
+    case TYPE_SEQUENCE:
+    case TYPE_LIST:
+      break;
+
+    case TYPE_BOOLEAN:
+      wattron(window, COLOR_PAIR(COLOR_FOR_BOOL));
+      wprintw(window, object->data.integer.value ? " TRUE" : " FALSE");
+      wattroff(window, COLOR_PAIR(COLOR_FOR_BOOL));
+      break;
+
+    case TYPE_INTEGER:
+    case TYPE_ENUM: {
+      const char *str;
+
+      str = integer_name(object);
+      if (str) {
+        wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
+        wprintw(window, " %s", str);
+        wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
+        wprintw(window, " (");
+      }
+      wattron(window, COLOR_PAIR(COLOR_FOR_INT));
+      if (object->type->type == TYPE_ENUM)
+        wprintw(window, str ? "%"PRId64 : " %"PRId64, (int64_t)object->data.integer.value);
+      else
+        wprintw(window, str ? "%"PRIu64 : " %"PRIu64, object->data.integer.value);
+      wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
+      if (str)
+        wprintw(window, ")");
+    } break;
+
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING: {
+      /* Almost everything we have at CICS is encoded as OCTET STRINGs; ip addresses, numberstrings, numbers, milliseconds etc,
+       * so octet_display() decides what the value really is, from its field and the value itself */
+      int truncated;
+      u64 val;
+      const char *str;
+
+      if (object->type->type == TYPE_BIT_STRING && object->type->primitive.names) {
+        wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
+        wprintw(window, " %s", bit_string_names(object));
+        wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
+        break;
+      }
+
+      switch (octet_display(object, &str)) {
+        case DISPLAY_IP:
+          val = octet_to_int(object);
+          wattron(window, COLOR_PAIR(COLOR_FOR_IP));
+          wprintw(window, " %"PRIu64 ".%"PRIu64 ".%"PRIu64 ".%"PRIu64, (val & 0xFF000000) >> 24, (val & 0xFF0000) >> 16, (val & 0xFF00) >> 8, val & 0xFF);
+          wattroff(window, COLOR_PAIR(COLOR_FOR_IP));
+          break;
+
+        case DISPLAY_TIME:
+          wattron(window, COLOR_PAIR(COLOR_FOR_TIME));
+          wprintw(window, " %s", str);
+          wattroff(window, COLOR_PAIR(COLOR_FOR_TIME));
+
+          wprintw(window, " (");
+          wattron(window, COLOR_PAIR(COLOR_FOR_INT));
+          wprintw(window, "%"PRIu64, octet_to_int(object));
+          wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
+          wprintw(window, ")");
+          break;
+
+        case DISPLAY_TBCD:
+          wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
+          wprintw(window, " \"%s\"", str);
+          wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
+
+          if (object->data.string.len <= 8) {
+            wprintw(window, " (");
+            wattron(window, COLOR_PAIR(COLOR_FOR_INT));
+            wprintw(window, "%"PRIu64, octet_to_int(object));
+            wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
+            wprintw(window, ")");
+          }
+          break;
+
+        case DISPLAY_INTEGER:
+          wattron(window, COLOR_PAIR(COLOR_FOR_INT));
+          wprintw(window, " %"PRIu64, octet_to_int(object));
+          wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
+          break;
+
+        case DISPLAY_TEXT:
+          wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
+          wprintw(window, " \"%.*s\"", (int)MIN(object->data.string.len, INT_MAX), object->data.string.value);
+          wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
+          break;
+
+        case DISPLAY_HEX:
+          str = octet_to_hex(object, &truncated);
+          wattron(window, COLOR_PAIR(COLOR_FOR_HEX));
+          wprintw(window, " 0x%s", str);
+          wattroff(window, COLOR_PAIR(COLOR_FOR_HEX));
+          if (truncated)
+            wprintw(window, "...");
+          break;
+      }
+    } break;
+
+    case TYPE_PRINTABLE_STRING:
+    case TYPE_IA5_STRING:
+    case TYPE_UTF8_STRING:
+      wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
+      wprintw(window, " \"%.*s\"", (int)MIN(object->data.string.len, INT_MAX), object->data.string.value);
+      wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
+      break;
+
+    default:
+      print_error("Type not supported:\n");
+      print_definition(object->type, 0);
+      exit(1);
+  }
 }
 
-typedef enum {
-  MODE_NORMAL,
-  MODE_HELP,
-  MODE_EDIT
-} Mode;
-
-static void edit_init() {
-  int w,h, x,y;
-  if (Global.editw)
-    return;
 
-  getmaxyx(stdscr, h, w);
+#endif /* COMPILE_INTERACTIVE_MODE */
 
-  y = h/2 - 5;
-  x = w/2 - 15;
-  Global.editw = subwin(Global.objw, 10, 30, y, x);
-  Global.edit_input = subwin(Global.editw, 1, 24, y + 4, x + 3);
 
-  wbkgdset(Global.edit_input, COLOR_PAIR(CURSES_INV));
-  array_resize(Global.edit_buffer, 0);
-}
 
-static void edit_end() {
-  delwin(Global.editw);
-  delwin(Global.edit_input);
-  Global.editw = Global.edit_input = 0;
-}
 
-static void render_edit() {
-  int w, l;
-  Object *o;
 
-  o = Global.current_object;
+/* Prints one object, without its children */
+static void dump_object(Object *object, int indent) {
+  char item_name[32];
+  const char *name;
 
-  werase(Global.editw);
-  werase(Global.edit_input);
+  name = object_name(object, item_name);
+  switch (object->type->type) {
+    case TYPE_CHOICE:
+    case TYPE_SEQUENCE:
+    case TYPE_LIST:
+      if (name)
+        printf(TABS "%s%s%s\n", TAB(indent), NORMAL, name, NORMAL);
+      break;
 
-  w = getmaxx(Global.editw);
-  box(Global.editw, '|', '-');
+    case TYPE_BOOLEAN:
+      if (name)
+        printf(TABS "%s%s%s ", TAB(indent), NORMAL, name, NORMAL);
+      printf("%s%s%s\n", BLUE, object->data.integer.value ? "TRUE" : "FALSE", NORMAL);
+      break;
 
-  l = strlen(o->name);
-  mvwprintw(Global.editw, 2, w/2 - l/2, "%s", o->name);
+    case TYPE_INTEGER: {
+      const char *str;
 
-  wattron(Global.edit_input, COLOR_PAIR(CURSES_INV));
-  mvwprintw(Global.edit_input, 0, 0, "%.*s", array_len(Global.edit_buffer), Global.edit_buffer);
-  wattroff(Global.edit_input, COLOR_PAIR(CURSES_INV));
-}
+      if (name)
+        printf(TABS "%s%s%s ", TAB(indent), NORMAL, name, NORMAL);
+      str = integer_name(object);
+      if (str)
+        printf("%s%s%s (%s%"PRIu64 "%s)\n", BLUE, str, NORMAL, GREEN, object->data.integer.value, NORMAL);
+      else
+        printf("%s%"PRIu64 "%s\n", GREEN, object->data.integer.value, NORMAL);
+    } break;
 
-static void message_box(const char *str) {
-  int w,h, l;
-  WINDOW *win;
-  getmaxyx(stdscr, h, w);
-  l = strlen(str);
-  win = subwin(stdscr, 5, l + 4, h/2 - 3, w/2 - l/2 - 2);
-  werase(win);
-  box(win, '|', '-');
-  mvwprintw(win, 2, 2, "%s", str);
-  wrefresh(win);
-  wgetch(win);
-  delwin(win);
-}
+    case TYPE_ENUM: {
+      const char *str;
 
-static void run_interactive(ASN1_Typedef *start_type) {
-  Object *root;
-  Mode mode = MODE_NORMAL;
-  int width, height;
+      if (name)
+        printf(TABS "%s%s%s ", TAB(indent), NORMAL, name, NORMAL);
+      str = integer_name(object);
+      if (str)
+        printf("%s%s%s (%s%"PRId64 "%s)\n", BLUE, str, NORMAL, GREEN, (int64_t)object->data.integer.value, NORMAL);
+      else
+        printf("%s%"PRId64 "%s\n", GREEN, (int64_t)object->data.integer.value, NORMAL);
+    } break;
 
-  /* create a fake root */
-  root = malloc(sizeof(*root));
-  root->parent = 0;
-  root->name = Global.filename;
-  root->type = malloc(sizeof(*root->type));
-  root->type->type = TYPE_LIST;
-  root->type->list.item_type = start_type->type;
-  root->data.sequence.values = 0;
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING: {
+      /* Almost everything we have at CICS is encoded as OCTET STRINGs; ip addresses, numberstrings, numbers, milliseconds etc,
+       * so octet_display() decides what the value really is, from its field and the value itself */
+      int truncated;
+      u64 val;
+      const char *str;
 
-  initscr();
-  curs_set(0);
-  start_color();
-  init_pair(CURSES_GREEN, COLOR_GREEN, COLOR_BLACK);
-  init_pair(CURSES_BLUE, COLOR_BLUE, COLOR_BLACK);
-  init_pair(CURSES_YELLOW, COLOR_YELLOW, COLOR_BLACK);
-  init_pair(CURSES_INV, COLOR_BLACK, COLOR_WHITE);
-  getmaxyx(stdscr, height, width);
+      if (name)
+        printf(TABS "%s%s%s ", TAB(indent), NORMAL, name, NORMAL);
 
-  Global.objw = newwin(height-1, width, 0, 0);
-  keypad(Global.objw, 1);
-  scrollok(Global.objw, 1);
+      if (object->type->type == TYPE_BIT_STRING && object->type->primitive.names) {
+        printf("%s%s%s\n", BLUE, bit_string_names(object), NORMAL);
+        break;
+      }
 
-  Global.statusw = newwin(1, width, height-1, 0);
-  wcolor_set(Global.statusw, COLOR_FOR_STATUSBAR, 0);
-  wbkgdset(Global.statusw, COLOR_PAIR(COLOR_FOR_STATUSBAR));
+      switch (octet_display(object, &str)) {
+        case DISPLAY_IP:
+          val = octet_to_int(object);
+          printf("%s%"PRIu64 ".%"PRIu64 ".%"PRIu64 ".%"PRIu64 "%s\n", BLUE, (val & 0xFF000000) >> 24, (val & 0xFF0000) >> 16, (val & 0xFF00) >> 8, val & 0xFF, NORMAL);
+          break;
 
-  for (;;) {
-    Object *o;
+        case DISPLAY_TIME:
+          printf("%s%s%s", BLUE, str, NORMAL);
+          printf(" (%s%"PRIu64 "%s)\n", GREEN, octet_to_int(object), NORMAL);
+          break;
 
-    o = decode(start_type->type, start_type->name, 0, 0, 0);
-    if (!o)
-      break;
-    o->parent = root;
-    array_push(root->data.sequence.values, o);
-  }
-  Global.current_object = root;
+        case DISPLAY_TBCD:
+          printf("\"%s%s%s\"", BLUE, str, NORMAL);
+          if (object->data.string.len <= 8)
+            printf(" (%s%"PRIu64 "%s)", GREEN, octet_to_int(object), NORMAL);
+          printf("\n");
+          break;
 
-  for (;;) {
-    int c, y, y_max, x_max, current_object_y, w,h;
+        case DISPLAY_INTEGER:
+          printf("%s%"PRIu64"%s\n", GREEN, octet_to_int(object), NORMAL);
+          break;
 
-    getmaxyx(stdscr, h, w);
-    if (w != width || h != height) {
-      wresize(Global.objw, h-1, w);
-      mvwin(Global.objw, 0, 0);
-      wresize(Global.statusw, 1, w);
-      mvwin(Global.statusw, h-1, 0);
-      width = w, height = h;
-    }
+        case DISPLAY_TEXT:
+          printf(" (%s" "\"%.*s\"" "%s)\n", BLUE, (int)MIN(object->data.string.len, INT_MAX), object->data.string.value, NORMAL);
+          break;
 
-    werase(Global.objw);
-    werase(Global.statusw);
+        case DISPLAY_HEX:
+          str = octet_to_hex(object, &truncated);
+          printf("%s0x%s", GREEN, str);
+          if (truncated)
+            printf("%s...\n", NORMAL);
+          printf("%s\n", NORMAL);
+          break;
+      }
+    } break;
 
-    getmaxyx(Global.objw, y_max, x_max);
-    y = 0;
-    current_object_y = -1;
-    switch (mode) {
-    case MODE_NORMAL:
-      render_tree(Global.objw, root, 0, x_max, &y, y_max, &current_object_y);
-      render_status_bar(Global.statusw);
-      break;
-    case MODE_HELP:
-      print_help(Global.objw);
-      break;
-    case MODE_EDIT:
-      render_tree(Global.objw, root, 0, x_max, &y, y_max, &current_object_y);
-      render_edit();
-      touchwin(Global.objw);
-      render_status_bar(Global.statusw);
+    case TYPE_PRINTABLE_STRING:
+    case TYPE_IA5_STRING:
+    case TYPE_UTF8_STRING:
+      if (name)
+        printf(TABS "%s%s%s ", TAB(indent), NORMAL, name, NORMAL);
+      printf("%s\"%.*s\"%s\n", BLUE, (int)MIN(object->data.string.len, INT_MAX), object->data.string.value, NORMAL);
       break;
-    }
 
-    wrefresh(Global.objw);
-    if (Global.editw) {
-      wrefresh(Global.editw);
-      wrefresh(Global.edit_input);
-    }
-    wrefresh(Global.statusw);
+    default:
+      print_error("Type not supported:\n");
+      print_definition(object->type, 0);
+      exit(1);
+  }
+}
 
-    c = wgetch(Global.objw);
+static void dump_object_tree(int i, int indent) {
+  int child;
 
-    switch (mode) {
-    case MODE_HELP:
-      mode = MODE_NORMAL;
-      break;
-    case MODE_EDIT:
-      if (c == KEY_ENTER || c == 10 || c == 13) {
-        array_push(Global.edit_buffer, 0);
-        Global.current_object->data.integer.value = atol(Global.edit_buffer);/*strtoull(Global.edit_buffer, 0, 10);*/
-        goto end_edit;
-      }
-      else if (c == KEY_BACKSPACE) {
-        if (array_len(Global.edit_buffer) > 0)
-          --array_len_get(Global.edit_buffer);
-      }
+  if (object_is_unexpanded(Global.objects + i))
+    object_expand_contents(i);
 
-      else if (isdigit(c))
-        array_push(Global.edit_buffer, c);
-      else
-        goto end_edit;
+  dump_object(Global.objects + i, indent);
+  for (child = object_first_child(i); child != -1; child = object_next_sibling(child))
+    dump_object_tree(child, indent+1);
+}
 
-      break;
+static void dump_all(ASN1_Typedef *start_type) {
+  int o;
 
-      end_edit:
-      edit_end();
-      mode = MODE_NORMAL;
-      break;
-    case MODE_NORMAL:
-      switch (c) {
-      case 'q':
-        goto done;
+  while (record_next()) {
+    /* each record is printed as soon as it is decoded, so they can all use the same memory */
+    array_resize(Global.objects, 0);
+    o = decode(start_type->type, start_type->name, 0, 0, 0, 0);
+    dump_object_tree(o, 0);
+  }
+}
 
-      case 'e':
-        if (Global.current_object->type->type != TYPE_INTEGER) {
-          message_box("Editing only supported for integers");
-          break;
+/* Prints each event from the push decoder like dump_object() would print the node */
+static void dump_event(PushEvent *e, void *userdata) {
+  char item_name[32];
+  Object object;
+
+  if (e->event == PUSH_END)
+    return;
+
+  memset(&object, 0, sizeof(object));
+  object.type = e->type;
+  object.name = e->name;
+  object.item = e->item;
+
+  if (e->event == PUSH_VALUE) {
+    switch (e->type->type) {
+      case TYPE_BOOLEAN:
+        if (e->len != 1) {
+          printf("\n\n%sError at byte %"PRIu64 ": Length of boolean was not 1, but %"PRId64 "%s\n", RED, e->offset, e->len, NORMAL);
+          exit(1);
         }
-        edit_init();
-        mode = MODE_EDIT;
+        object.data.integer.value = e->value[0];
         break;
-
-      case '?':
-        mode = MODE_HELP;
+      case TYPE_INTEGER:
+      case TYPE_ENUM:
+        if (!ber_integer_value(e->type, e->value, e->len, &object.data.integer.value)) {
+          printf("\n\n%sError at byte %"PRIu64 ": %s is %"PRId64 " bytes long, which is more than 8%s\n", RED, e->offset, object_name(&object, item_name), e->len, NORMAL);
+          exit(1);
+        }
+        break;
+      default:
+        object.data.string.value = (unsigned char*)e->value;
+        object.data.string.len = e->len;
         break;
+    }
+  }
 
-      case '=': {
-        Object **siblings;
-        int num_siblings;
-        int i;
+  /* the children come as their own events */
+  dump_object(&object, e->depth);
+}
 
-        object_get_siblings(Global.current_object, &siblings, &num_siblings);
-        if (!siblings)
-          break;
-        for (i = 0; i < num_siblings; ++i)
-          if (type_is_compound(siblings[i]->type))
-            siblings[i]->collapsed = 1;
-      } break;
+/* Decodes the file in chunks as it is read, so it never has to be in memory all at once */
+static void stream_all(ASN1_Typedef *start_type, FILE *file) {
+  static unsigned char buffer[1 << 16];
+  PushDecoder d;
+  size_t n;
 
-      case 'h':
-      case KEY_LEFT: {
-        /* if already collapsed, collaps parent */
-        if ((type_is_primitive(Global.current_object->type) || Global.current_object->collapsed) && Global.current_object->parent)
-          Global.current_object = Global.current_object->parent;
-        else
-          Global.current_object->collapsed = 1;
-      } break;
+  push_init(&d, start_type, dump_event, 0);
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    if (!push_feed(&d, buffer, n))
+      break;
 
-      case 'l':
-      case KEY_RIGHT:
-        Global.current_object->collapsed = 0;
-        break;
+  if (!push_finish(&d)) {
+    printf("\n\n%sError at byte %"PRIu64 ": %s%s\n", RED, d.offset, d.error, NORMAL);
+    exit(1);
+  }
+  push_free(&d);
+}
 
-      case 'k':
-      case KEY_UP: {
-        int i;
-        Object **siblings, **children;
-        int num_siblings, num_children;
+static int validate_all(ASN1_Typedef *start_type) {
+  int num_records = 0, num_invalid = 0, ok;
+  unsigned char *end, *start;
 
-        object_get_siblings(Global.current_object, &siblings, &num_siblings);
-        if (!siblings)
-          goto jump_to_parent;
+  while (Global.data < array_end(Global.data_begin)) {
+    start = Global.data;
+    ++num_records;
 
-        for (i = 0; i < num_siblings; ++i)
-          if (siblings[i] == Global.current_object)
-            break;
-        assert(i != num_siblings);
+    end = record_end_peek();
+    if (!end) {
+      printf("Record %i at byte %"PRId64 ": %s, can't find the next record\n", num_records, (i64)(start - Global.data_begin), validate_error.msg);
+      ++num_invalid;
+      break;
+    }
 
-        if (i == 0)
-          goto jump_to_parent;
+    ok = validate(start_type->type, start_type->name, 0, end);
+    if (ok && Global.data != end)
+      ok = validate_fail("Record has %"PRId64 " bytes left over", (i64)(end - Global.data));
 
-        /* we go to sibling, and then continue down as far as possible */
-        Global.current_object = siblings[i-1];
-        while (!Global.current_object->collapsed && (object_get_children(Global.current_object, &children, &num_children), children))
-          Global.current_object = children[num_children-1];
-        break;
+    if (!ok) {
+      printf("Record %i at byte %"PRId64 ": %s (at byte %"PRId64 ")\n", num_records, (i64)(start - Global.data_begin), validate_error.msg, (i64)(validate_error.pos - Global.data_begin));
+      ++num_invalid;
+    }
+    Global.data = end;
+  }
 
-        jump_to_parent:
-        if (Global.current_object->parent)
-          Global.current_object = Global.current_object->parent;
-      } break;
+  printf("%i records, %i valid, %i invalid\n", num_records, num_records - num_invalid, num_invalid);
+  return num_invalid;
+}
 
-      case 'j':
-      case KEY_DOWN: {
-        Object **children;
-        int num_children;
+/** BATCH MODE **/
 
-        object_get_children(Global.current_object, &children, &num_children);
+/* Each file is decoded in a process of its own, forked after the schema is parsed, so the schema is only parsed once
+ * and shared between them. Since errors exit the process, a broken file can't take the others down with it */
 
-        if (!Global.current_object->collapsed && children) {
-          Global.current_object = children[0];
-          break;
-        }
-        else {
-          Object **siblings;
-          int num_siblings;
-          Object *next;
-
-          next = Global.current_object;
-
-          for (;;) {
-            /* find the next sibling */
-            int i;
-
-            object_get_siblings(next, &siblings, &num_siblings);
-            if (!siblings)
-              goto dont_move;
-
-            for (i = 0; i < num_siblings; ++i)
-              if (siblings[i] == next)
-                break;
-            assert(i != num_siblings);
-
-            if (i+1 >= num_siblings) {
-              /* if last sibling, go to parents sibling */
-              if (!next->parent)
-                break;
-              next = next->parent;
-              continue;
-            }
-
-            next = siblings[i+1];
-            break;
-          }
+#ifdef COMPILE_BATCH_MODE
+typedef struct {
+  char *path;
+  pid_t pid;
+  int status;
+  int done;
+  /* when the outputs are merged, where the process writes until it is the file's turn to be printed */
+  FILE *output;
+} BatchFile;
+
+static int batch_path_cmp(const void *a, const void *b) {
+  return strcmp(*(char**)a, *(char**)b);
+}
 
-          Global.current_object = next;
-          dont_move:;
-        }
-      } break;
+/* The regular files in dir, in order by name, or if dir is -, the files listed on stdin */
+static Array(char*) batch_files_list(const char *dir) {
+  Array(char*) result = 0;
+  struct dirent *entry;
+  struct stat st;
+  char line[4096], *path;
+  DIR *d;
+  int n;
+
+  if (strcmp(dir, "-") == 0) {
+    while (fgets(line, sizeof(line), stdin)) {
+      n = strlen(line);
+      while (n && isspace((unsigned char)line[n-1]))
+        line[--n] = 0;
+      if (n)
+        array_push(result, strdup(line));
+    }
+    return result;
+  }
 
-      default:
-        break;
-      }
-      break;
+  d = opendir(dir);
+  if (!d)
+    die("Failed to open directory %s: %s\n", dir, strerror(errno));
+  while ((entry = readdir(d))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    path = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+    sprintf(path, "%s/%s", dir, entry->d_name);
+    if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+      free(path);
+      continue;
     }
-    
+    array_push(result, path);
   }
-  done:
-  endwin();
+  closedir(d);
+  qsort(result, array_len(result), sizeof(*result), batch_path_cmp);
+  return result;
+}
+
+/* Runs in the forked process, and never returns */
+static void batch_decode(ASN1_Typedef *start_type, BatchFile *file, const char *output_dir, int validate_only) {
+  const char *name;
+  char *output;
+
+  if (output_dir) {
+    name = strrchr(file->path, '/');
+    name = name ? name+1 : file->path;
+    output = malloc(strlen(output_dir) + strlen(name) + 6);
+    sprintf(output, "%s/%s.txt", output_dir, name);
+    if (!freopen(output, "w", stdout)) {
+      fprintf(stderr, "Failed to open %s: %s\n", output, strerror(errno));
+      exit(1);
+    }
+    init_colors();
+  }
+  else
+    dup2(fileno(file->output), fileno(stdout));
+
+  Global.data_begin = Global.data = file_get_contents(file->path);
+  Global.filename = file->path;
+  if (!Global.data)
+    die("Failed to read contents of %s: %s\n", file->path, strerror(errno));
+
+  if (validate_only)
+    exit(validate_all(start_type) ? 2 : 0);
+  dump_all(start_type);
+  print_violations();
+  exit(0);
 }
 
-static int render_tree(WINDOW* window, Object *object, int x, int x_max, int *y, int y_max, int *current_object_y) {
-  Object **children;
-  int num_children, i;
-  int wy;
+static void batch_output_copy(FILE *from) {
+  char buf[1 << 16];
+  size_t n;
 
-  wy = MIN(*y, y_max-1);
+  rewind(from);
+  while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+    fwrite(buf, 1, n, stdout);
+  fclose(from);
+}
 
-  /* have we gone at least half a screen past the selected object? */
-  if (*y >= y_max && *current_object_y != -1 && *y - *current_object_y > y_max/2)
-    return 1;
+/* Decodes the files in dir, jobs at a time. The outputs go to a file for each in output_dir, or if it is 0,
+ * to stdout in the order of the files. Returns the number of files that failed */
+static int run_batch(ASN1_Typedef *start_type, const char *dir, const char *output_dir, int jobs, int validate_only) {
+  Array(BatchFile) files = 0;
+  Array(char*) paths;
+  BatchFile *f;
+  int next = 0, next_output = 0, running = 0, num_failed = 0, status, i;
+  pid_t pid;
+
+  paths = batch_files_list(dir);
+  array_resize(files, array_len(paths));
+  memset(files, 0, array_len(files) * sizeof(*files));
+  for (i = 0; i < array_len(paths); ++i)
+    files[i].path = paths[i];
+
+  while (next_output < array_len(files)) {
+    /* the outputs wait in open files until it is their turn, so don't get too far ahead of the one that is next */
+    for (; running < jobs && next < array_len(files) && (output_dir || next - next_output < 64); ++next, ++running) {
+      f = files + next;
+      if (!output_dir && !(f->output = tmpfile()))
+        die("Failed to create a temporary file: %s\n", strerror(errno));
+      fflush(stdout);
+      f->pid = fork();
+      if (f->pid < 0)
+        die("Failed to start a process for %s: %s\n", f->path, strerror(errno));
+      if (!f->pid)
+        batch_decode(start_type, f, output_dir, validate_only);
+    }
 
-  /* if we're not done, scroll down one and keep going */
-  if (*y >= y_max)
-    wscrl(window, 1);
+    pid = wait(&status);
+    if (pid < 0)
+      die("Failed waiting for a batch process: %s\n", strerror(errno));
+    array_find(files, f, f->pid == pid);
+    if (!f)
+      continue;
+    f->status = status;
+    f->done = 1;
+    --running;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+      ++num_failed;
+      if (WIFEXITED(status))
+        fprintf(stderr, "%s: failed with exit code %i\n", f->path, WEXITSTATUS(status));
+      else
+        fprintf(stderr, "%s: killed by signal %i\n", f->path, WTERMSIG(status));
+    }
 
-  wmove(window, wy, 0);
-  wclrtoeol(window);
+    /* print the outputs that are next in line */
+    for (; next_output < array_len(files) && files[next_output].done; ++next_output)
+      if (!output_dir)
+        batch_output_copy(files[next_output].output);
+  }
+  fflush(stdout);
 
-  if (type_is_compound(object->type))
-    mvwprintw(window, wy, x, object->collapsed ? "+" : "-");
+  fprintf(stderr, "%i files, %i failed\n", (int)array_len(files), num_failed);
+  return num_failed;
+}
+#endif /* COMPILE_BATCH_MODE */
 
-  if (object == Global.current_object)
-    *current_object_y = *y;
-  render_object(window, object, x+2, x_max, wy);
+/** SERVER **/
 
-  ++(*y);
+/* --serve keeps the schema loaded and decodes what clients send it over a unix socket.
+ * A request is one line, then the data if there is any:
+ *
+ *   decode|validate TYPENAME text|color file PATH
+ *   decode|validate TYPENAME text|color data LENGTH
+ *
+ * The output is written back as it is made, with colors or without, and the connection is closed when it is done.
+ * Like in batch mode, every request is handled by a process of its own, forked from the server.
+ * A file is read with the permissions of the server, so the socket is made so that only its user can connect */
 
-  if (object->collapsed)
-    return 0;
+#ifdef COMPILE_BATCH_MODE
+enum {
+  /* the most data a request can send along, since it is read into memory. Larger files are better given by path */
+  SERVER_MAX_DATA = 1 << 30
+};
 
-  object_get_children(object, &children, &num_children);
-  if (!num_children)
-    return 0;
+static int socket_read_all(int fd, void *buf, i64 n) {
+  i64 r;
+  for (; n > 0; buf = (char*)buf + r, n -= r) {
+    r = read(fd, buf, n);
+    if (r <= 0)
+      return 0;
+  }
+  return 1;
+}
 
-  for (i = 0; i < num_children; ++i)
-    if (render_tree(window, children[i], x + 2, x_max, y, y_max, current_object_y))
-      return 1;
-  return 0;
+static int socket_write_all(int fd, const void *buf, i64 n) {
+  i64 r;
+  for (; n > 0; buf = (const char*)buf + r, n -= r) {
+    r = write(fd, buf, n);
+    if (r <= 0)
+      return 0;
+  }
+  return 1;
 }
 
-static void render_object(WINDOW *window, Object *object, int x, int x_max, int y) {
-  /* WARNING: If you make changes here, remember to mirror the changes in dump_object_tree */
-  wmove(window, y, x);
+static int socket_open(const char *path, struct sockaddr_un *addr) {
+  int fd;
 
-  if (object == Global.current_object)
-    wattron(window, COLOR_PAIR(COLOR_FOR_SELECTED));
-  wprintw(window, "%s", object->name);
-  if (object == Global.current_object)
-    wattroff(window, COLOR_PAIR(COLOR_FOR_SELECTED));
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", path);
+    exit(1);
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create a socket: %s\n", strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
 
-  switch (object->type->type) {
-    case TYPE_CHOICE:
-    case TYPE_SEQUENCE:
-    case TYPE_LIST:
-      break;
+/* Runs in the forked process, and never returns */
+static void serve_request(int fd) {
+  ASN1_Typedef *start_type;
+  char line[4096], mode[16], type_name[256], format[16], source[16], *arg;
+  long long len;
+  int i, arg_pos = -1;
 
-    case TYPE_BOOLEAN:
-      wattron(window, COLOR_PAIR(COLOR_FOR_BOOL));
-      wprintw(window, object->data.integer.value ? " TRUE" : " FALSE");
-      wattroff(window, COLOR_PAIR(COLOR_FOR_BOOL));
-      break;
+  dup2(fd, fileno(stdout));
+  set_colors(0);
 
-    case TYPE_INTEGER:
-      wattron(window, COLOR_PAIR(COLOR_FOR_INT));
-      wprintw(window, " %"PRIu64, object->data.integer.value);
-      wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
-      break;
+  for (i = 0; i < (int)sizeof(line)-1 && read(fd, line+i, 1) == 1 && line[i] != '\n'; ++i);
+  line[i] = 0;
+  if (sscanf(line, "%15s %255s %15s %15s %n", mode, type_name, format, source, &arg_pos) != 4 || arg_pos < 0 || !line[arg_pos] ||
+      (strcmp(mode, "decode") && strcmp(mode, "validate")) || (strcmp(format, "text") && strcmp(format, "color")))
+    printf("Expected: decode|validate TYPENAME text|color file PATH, or decode|validate TYPENAME text|color data LENGTH\n"), exit(1);
+  arg = line + arg_pos;
+  set_colors(strcmp(format, "color") == 0);
 
-    case TYPE_OCTET_STRING:
-    case TYPE_BIT_STRING: {
-      /* This code is weird because almost everything we have at CICS is encoded as OCTET STRINGs;
-       * ip addresses, numberstrings, numbers, milliseconds etc,
-       * so we employ some heuristics on common cases to try to figure out what the value really is
-       */
-      int i;
-      const char *str;
+  start_type = get_type_by_name(type_name);
+  if (!start_type)
+    printf("Found no type '%s' in definition\n", type_name), exit(1);
 
-      /* if it's small, it might be something special */
-      if (object->data.string.len <= 8) {
-        u64 val = octet_to_int(object);
+  if (strcmp(source, "file") == 0) {
+    Global.data_begin = file_get_contents(arg);
+    Global.filename = arg;
+    if (!Global.data_begin)
+      printf("Failed to read contents of %s: %s\n", arg, strerror(errno)), exit(1);
+  }
+  else if (strcmp(source, "data") == 0 && sscanf(arg, "%lld", &len) == 1 && len >= 0) {
+    if (len > SERVER_MAX_DATA)
+      printf("%lld bytes of data is more than the %i a request can send, give the path of a file instead\n", len, SERVER_MAX_DATA), exit(1);
+    array_resize(Global.data_begin, len);
+    Global.filename = "data";
+    if (len && !socket_read_all(fd, Global.data_begin, len))
+      printf("Expected %lld bytes of data\n", len), exit(1);
+  }
+  else
+    printf("Expected file PATH or data LENGTH, but got \"%s\"\n", source), exit(1);
+  Global.data = Global.data_begin;
+
+  if (strcmp(mode, "validate") == 0)
+    exit(validate_all(start_type) ? 2 : 0);
+  dump_all(start_type);
+  print_violations();
+  exit(0);
+}
 
-        /* is it an ip address ? */
-        if (octet_is_ip_address(object)) {
-          wattron(window, COLOR_PAIR(COLOR_FOR_IP));
-          wprintw(window, " %"PRIu64 ".%"PRIu64 ".%"PRIu64 ".%"PRIu64, (val & 0xFF000000) >> 24, (val & 0xFF0000) >> 16, (val & 0xFF00) >> 8, val & 0xFF);
-          wattroff(window, COLOR_PAIR(COLOR_FOR_IP));
-          break;
-        }
+static void run_server(const char *path, int jobs) {
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd, client, running = 0, failed;
+  mode_t mask;
+  pid_t pid;
 
-        /* could it be a timestamp ? */
-        str = int_to_time(val);
-        if (str) {
-          wattron(window, COLOR_PAIR(COLOR_FOR_TIME));
-          wprintw(window, " %s", str);
-          wattroff(window, COLOR_PAIR(COLOR_FOR_TIME));
+  fd = socket_open(path, &addr);
 
-          wprintw(window, " (");
-          wattron(window, COLOR_PAIR(COLOR_FOR_INT));
-          wprintw(window, "%"PRIu64, val);
-          wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
-          wprintw(window, ")");
-          break;
-        }
+  /* a socket left behind by an earlier server is replaced, but nothing else is */
+  if (!lstat(path, &st)) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "%s already exists, and is not a socket\n", path);
+      exit(1);
+    }
+    unlink(path);
+  }
 
-        /* could it be a numberstring? */
-        str = octet_to_numberstring(object);
-        if (str) {
-          wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
-          wprintw(window, " \"%s\"", str);
-          wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
+  /* only our own user can connect, since the requests can read any file we can */
+  mask = umask(077);
+  failed = bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 64);
+  umask(mask);
+  if (failed) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  fprintf(stderr, "Listening on %s\n", path);
 
-          wprintw(window, " (");
-          wattron(window, COLOR_PAIR(COLOR_FOR_INT));
-          wprintw(window, "%"PRIu64, val);
-          wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
-          wprintw(window, ")");
-          break;
-        }
+  for (;;) {
+    /* reap what has finished, and wait for a free slot if all are busy */
+    while (running && waitpid(-1, 0, running < jobs ? WNOHANG : 0) > 0)
+      --running;
+
+    client = accept(fd, 0, 0);
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Failed to accept a connection: %s\n", strerror(errno));
+      exit(1);
+    }
+    fflush(stdout);
+    pid = fork();
+    if (!pid) {
+      close(fd);
+      serve_request(client);
+    }
+    if (pid > 0)
+      ++running;
+    else
+      fprintf(stderr, "Failed to start a process for a request: %s\n", strerror(errno));
+    close(client);
+  }
+}
 
+/* Sends the binary to a server, and prints what comes back. A binary of - is read from stdin */
+static int run_client(const char *path, const char *binary_file, const char *type_name, int validate_only) {
+  struct sockaddr_un addr;
+  Array(unsigned char) data = 0;
+  char header[4096 + 300], buf[1 << 16], *full_path;
+  const char *format;
+  i64 n;
+  int fd;
+
+  fd = socket_open(path, &addr);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
 
-        /* otherwise just print it as a number */
-        wattron(window, COLOR_PAIR(COLOR_FOR_INT));
-        wprintw(window, " %"PRIu64, val);
-        wattroff(window, COLOR_PAIR(COLOR_FOR_INT));
-        break;
-      }
+  /* the output comes back with colors if it would have them here */
+  format = stdout_is_a_terminal() ? "color" : "text";
+  if (strcmp(binary_file, "-") == 0) {
+    while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0)
+      array_push_a(data, buf, n);
+    n = snprintf(header, sizeof(header), "%s %s %s data %"PRId64 "\n", validate_only ? "validate" : "decode", type_name, format, (i64)array_len(data));
+  }
+  else {
+    /* the server may run in another directory */
+    full_path = realpath(binary_file, 0);
+    if (!full_path) {
+      fprintf(stderr, "Failed to find %s: %s\n", binary_file, strerror(errno));
+      exit(1);
+    }
+    n = snprintf(header, sizeof(header), "%s %s %s file %s\n", validate_only ? "validate" : "decode", type_name, format, full_path);
+    free(full_path);
+  }
+  if (n < 0 || n >= (i64)sizeof(header)) {
+    fprintf(stderr, "The path of %s, or the type name, is too long to send\n", binary_file);
+    exit(1);
+  }
+  if (!socket_write_all(fd, header, n) || !socket_write_all(fd, data, array_len(data))) {
+    fprintf(stderr, "Failed to send the request: %s\n", strerror(errno));
+    exit(1);
+  }
+  shutdown(fd, SHUT_WR);
 
-      /* is it printable as a string? */
-      if (octet_is_printable(object)) {
-        wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
-        wprintw(window, " \"%.*s\"", object->data.string.len, object->data.string.value);
-        wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
-        break;
-      }
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    fwrite(buf, 1, n, stdout);
+  close(fd);
+  return 0;
+}
+#endif /* COMPILE_BATCH_MODE */
 
-      /* otherwise print as hex */
-      wattron(window, COLOR_PAIR(COLOR_FOR_HEX));
-      wprintw(window, " 0x");
-      for (i = 0; i < object->data.string.len; ++i) {
-        if (i >= 20) {
-          wattroff(window, COLOR_PAIR(COLOR_FOR_HEX));
-          wprintw(window, "...");
-          break;
-        }
-        wprintw(window, "%.2x", object->data.string.value[i]);
-      }
-      wattroff(window, COLOR_PAIR(COLOR_FOR_HEX));
+/** WATCH MODE **/
 
-    } break;
+/* --watch decodes the files that are written to a directory, as they are closed. How far it got in each file is
+ * kept in a journal, so after a restart it goes on from the last record it printed instead of starting over.
+ * Each file is decoded in a process of its own, like in batch mode, which appends its progress to the journal */
 
-    case TYPE_PRINTABLE_STRING:
-    case TYPE_IA5_STRING:
-    case TYPE_UTF8_STRING:
-      wattron(window, COLOR_PAIR(COLOR_FOR_STRING));
-      wprintw(window, " \"%.*s\"", object->data.string.len, object->data.string.value);
-      wattroff(window, COLOR_PAIR(COLOR_FOR_STRING));
-      break;
+#ifdef COMPILE_WATCH_MODE
+enum {
+  /* how many records are printed between the checkpoints in the journal */
+  WATCH_CHECKPOINT_RECORDS = 1000
+};
 
-    default:
-      print_error("Type not supported:\n");
-      print_definition(object->type, 0);
-      exit(1);
+typedef struct {
+  char *name;
+  i64 offset;
+} WatchProgress;
+
+static struct {
+  const char *dir;
+  const char *journal_path;
+  /* read by the server as the processes append to it */
+  FILE *journal;
+  Array(WatchProgress) progress;
+
+  /* in the process decoding a file, its journal, and the record being decoded, if any */
+  const char *name;
+  FILE *decode_journal;
+  unsigned char *record, *record_end;
+} Watch;
+
+static WatchProgress *watch_progress(const char *name) {
+  WatchProgress *p, new_progress;
+
+  array_find(Watch.progress, p, strcmp(p->name, name) == 0);
+  if (p)
+    return p;
+  new_progress.name = strdup(name);
+  new_progress.offset = 0;
+  array_push(Watch.progress, new_progress);
+  return array_last(Watch.progress);
+}
+
+/* Reads the lines that have been added to the journal. Each is the offset of the first record not yet printed, and the file name */
+static void watch_journal_read(void) {
+  char line[4096];
+  long long offset;
+  int n;
+
+  clearerr(Watch.journal);
+  while (fgets(line, sizeof(line), Watch.journal)) {
+    n = strlen(line);
+    if (!n || line[n-1] != '\n')
+      continue;
+    line[n-1] = 0;
+    if (sscanf(line, "%lld %n", &offset, &n) == 1)
+      watch_progress(line + n)->offset = offset;
   }
 }
 
+/* Rewrites the journal with a line for each file */
+static void watch_journal_compact(void) {
+  WatchProgress *p;
+  char *tmp;
+  FILE *f;
 
-#endif /* COMPILE_INTERACTIVE_MODE */
+  tmp = malloc(strlen(Watch.journal_path) + 5);
+  sprintf(tmp, "%s.tmp", Watch.journal_path);
+  f = fopen(tmp, "w");
+  if (!f)
+    die("Failed to write %s: %s\n", tmp, strerror(errno));
+  array_foreach(Watch.progress, p)
+    fprintf(f, "%"PRId64 " %s\n", p->offset, p->name);
+  if (fclose(f) || rename(tmp, Watch.journal_path))
+    die("Failed to write %s: %s\n", Watch.journal_path, strerror(errno));
+  free(tmp);
+}
 
+static void watch_checkpoint(FILE *journal, const char *name) {
+  /* the output has to be out before the journal says it is */
+  fflush(stdout);
+  fprintf(journal, "%"PRId64 " %s\n", Global.data_offset + (i64)(Global.data - Global.data_begin), name);
+  fflush(journal);
+}
 
+/* Called when the decoding process exits. If it was in the middle of a record, that record failed to decode,
+ * so it is skipped, or it would be printed up to the failure again every time the file is written */
+static void watch_decode_exit(void) {
+  if (!Watch.record)
+    return;
+  fprintf(stderr, "%s: skipping the record at byte %"PRId64 ", which failed to decode\n", Watch.name, Global.data_offset + (i64)(Watch.record - Global.data_begin));
+  Global.data = Watch.record_end;
+  watch_checkpoint(Watch.decode_journal, Watch.name);
+}
 
+/* Runs in the forked process, and never returns */
+static void watch_decode(ASN1_Typedef *start_type, const char *name, const char *path, i64 offset) {
+  unsigned char *end;
+  struct stat st;
+  FILE *journal, *f;
+  i64 n;
+  int o;
+
+  journal = fopen(Watch.journal_path, "a");
+  if (!journal)
+    die("Failed to open %s: %s\n", Watch.journal_path, strerror(errno));
+  Watch.name = name;
+  Watch.decode_journal = journal;
+  atexit(watch_decode_exit);
+  Global.filename = path;
+  f = fopen(path, "rb");
+  if (!f || fstat(fileno(f), &st))
+    exit(0);
+  /* the file was replaced by a shorter one */
+  if (offset > st.st_size)
+    offset = 0;
+
+  /* only what was written since the offset is read, so a file that is written a little at a time isn't read all over each time */
+  if (fseek64(f, offset, SEEK_SET))
+    die("Failed to seek in %s: %s\n", path, strerror(errno));
+  array_resize(Global.data_begin, st.st_size - offset);
+  n = fread(Global.data_begin, 1, array_len(Global.data_begin), f);
+  array_resize(Global.data_begin, n);
+  fclose(f);
+  Global.data_offset = offset;
+  Global.data = Global.data_begin;
+
+  for (n = 1; Global.data < array_end(Global.data_begin); ++n) {
+    /* a record that isn't all there is left for when the file is written again */
+    end = record_end_peek();
+    if (!end) {
+      fprintf(stderr, "%s: stopped at byte %"PRId64 ": %s\n", name, Global.data_offset + (i64)(Global.data - Global.data_begin), validate_error.msg);
+      break;
+    }
+    array_resize(Global.objects, 0);
+    Watch.record = Global.data;
+    Watch.record_end = end;
+    o = decode(start_type->type, start_type->name, 0, 0, 0, 0);
+    dump_object_tree(o, 0);
+    Watch.record = 0;
+    if (n % WATCH_CHECKPOINT_RECORDS == 0)
+      watch_checkpoint(journal, name);
+  }
+  if (Global.data != Global.data_begin)
+    watch_checkpoint(journal, name);
+  exit(0);
+}
 
+static void watch_file(ASN1_Typedef *start_type, const char *name) {
+  struct stat st;
+  char *path;
+  i64 offset;
+  int status;
+  pid_t pid;
 
-static void dump_object_tree(Object *object, int indent, int max_indent) {
-  Object **d;
+  path = malloc(strlen(Watch.dir) + strlen(name) + 2);
+  sprintf(path, "%s/%s", Watch.dir, name);
 
-  switch (object->type->type) {
-    case TYPE_CHOICE:
-      if (object->name)
-        printf(TABS "%s%s%s\n", TAB(indent), NORMAL, object->name, NORMAL);
-      if (!max_indent || indent+1 < max_indent)
-        dump_object_tree(object->data.choice.value, indent+1, max_indent);
-      break;
-    case TYPE_SEQUENCE:
-      if (object->name)
-        printf(TABS "%s%s%s\n", TAB(indent), NORMAL, object->name, NORMAL);
-      if (!max_indent || indent+1 < max_indent)
-        array_foreach(object->data.sequence.values, d)
-          dump_object_tree(*d, indent+1, max_indent);
-      break;
+  for (;;) {
+    offset = watch_progress(name)->offset;
 
-    case TYPE_LIST:
-      if (object->name)
-        printf(TABS "%s%s%s\n", TAB(indent), NORMAL, object->name, NORMAL);
-      if (!max_indent || indent+1 < max_indent)
-        array_foreach(object->data.sequence.values, d)
-          dump_object_tree(*d, indent+1, max_indent);
+    /* nothing new since last time */
+    if (!stat(path, &st) && st.st_size == offset)
       break;
 
-    case TYPE_BOOLEAN:
-      if (object->name)
-        printf(TABS "%s%s%s ", TAB(indent), NORMAL, object->name, NORMAL);
-      printf("%s%s%s\n", BLUE, object->data.integer.value ? "TRUE" : "FALSE", NORMAL);
+    fflush(stdout);
+    pid = fork();
+    if (!pid)
+      watch_decode(start_type, name, path, offset);
+    if (pid < 0 || waitpid(pid, &status, 0) < 0)
+      die("Failed to run a process for %s: %s\n", path, strerror(errno));
+    watch_journal_read();
+    if (WIFEXITED(status) && !WEXITSTATUS(status))
       break;
 
-    case TYPE_INTEGER:
-      if (object->name)
-        printf(TABS "%s%s%s ", TAB(indent), NORMAL, object->name, NORMAL);
-      printf("%s%"PRIu64 "%s\n", GREEN, object->data.integer.value, NORMAL);
+    /* a record that failed to decode was skipped, so go on with the ones after it */
+    if (watch_progress(name)->offset == offset) {
+      fprintf(stderr, "%s: failed, and will be tried again from where it stopped when it is written again\n", path);
       break;
+    }
+  }
+  free(path);
+}
 
-    case TYPE_OCTET_STRING:
-    case TYPE_BIT_STRING: {
-      /* This code is weird because almost everything we have at CICS is encoded as OCTET STRINGs;
-       * ip addresses, numberstrings, numbers, milliseconds etc,
-       * so we employ some heuristics on common cases to try to figure out what the value really is
-       */
-      int i;
-      const char *str;
-
-      if (object->name)
-        printf(TABS "%s%s%s ", TAB(indent), NORMAL, object->name, NORMAL);
-
-      /* if it's small, it might be something special */
-      if (object->data.string.len <= 8) {
-        u64 val = octet_to_int(object);
-
-        if (octet_is_ip_address(object)) {
-          printf("%s%"PRIu64 ".%"PRIu64 ".%"PRIu64 ".%"PRIu64 "%s\n", BLUE, (val & 0xFF000000) >> 24, (val & 0xFF0000) >> 16, (val & 0xFF00) >> 8, val & 0xFF, NORMAL);
-          break;
-        }
-
-        /* could it be a timestamp ? */
-        str = int_to_time(val);
-        if (str) {
-          printf("%s%s%s", BLUE, str, NORMAL);
-          printf(" (%s%"PRIu64 "%s)\n", GREEN, val, NORMAL);
-          break;
-        }
+static void run_watch(ASN1_Typedef *start_type, const char *dir, const char *journal_path) {
+  char buf[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *event;
+  Array(char*) files;
+  char **file;
+  const char *name;
+  int fd, n, i;
 
-        /* could it be a numberstring? */
-        str = octet_to_numberstring(object);
-        if (str) {
-          printf("\"%s%s%s\"", BLUE, str, NORMAL);
-          printf(" (%s%"PRIu64 "%s)\n", GREEN, val, NORMAL);
-          break;
-        }
+  Watch.dir = dir;
+  Watch.journal_path = journal_path;
+  if (!Watch.journal_path) {
+    Watch.journal_path = malloc(strlen(dir) + 18);
+    sprintf((char*)Watch.journal_path, "%s/.decoder-journal", dir);
+  }
 
-        /* otherwise just print it as a number */
-        printf("%s%"PRIu64"%s\n", GREEN, val, NORMAL);
-        break;
-      }
+  /* start watching before looking at what is there, so nothing written in between is missed */
+  fd = inotify_init();
+  if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    die("Failed to watch %s: %s\n", dir, strerror(errno));
+
+  Watch.journal = fopen(Watch.journal_path, "a+");
+  if (!Watch.journal)
+    die("Failed to open %s: %s\n", Watch.journal_path, strerror(errno));
+  rewind(Watch.journal);
+  watch_journal_read();
+  fclose(Watch.journal);
+  watch_journal_compact();
+  Watch.journal = fopen(Watch.journal_path, "r");
+  fseek(Watch.journal, 0, SEEK_END);
+
+  /* what was written while we weren't running */
+  files = batch_files_list(dir);
+  array_foreach(files, file)
+    watch_file(start_type, strrchr(*file, '/') + 1);
 
-      /* is it printable as a string? */
-      if (octet_is_printable(object)) {
-        printf(" (%s" "\"%.*s\"" "%s)\n", BLUE, object->data.string.len, object->data.string.value, NORMAL);
-        break;
-      }
+  for (;;) {
+    n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      die("Failed to read events for %s: %s\n", dir, strerror(errno));
+    for (i = 0; i < n; i += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event*)(buf + i);
+      name = event->name;
+      if (event->len && name[0] != '.')
+        watch_file(start_type, name);
+    }
+  }
+}
+#endif /* COMPILE_WATCH_MODE */
+
+/** FOLLOW MODE **/
+
+/* --follow decodes a file that is still being written, like tail -f. The records that are all there are printed,
+ * then it waits for more. Only what was appended is read, and the records that were printed are dropped from
+ * Global.data_begin, so nothing is decoded twice, and only the last chunk read and the record it ends in are kept in memory */
+
+#ifdef COMPILE_WATCH_MODE
+/* Returns the end of the record at Global.data, or 0 if not all of it has been read yet.
+ * Indefinite length records can't tell broken from unfinished, so a broken one is waited on forever */
+static unsigned char *follow_record_end(void) {
+  BerIdentifier bi;
+  unsigned char *eoc;
+  i64 len, left;
+  int header_size;
+
+  left = array_end(Global.data_begin) - Global.data;
+  header_size = ber_header_parse(Global.data, left, &bi, &len);
+  if (header_size < 0)
+    die("Malformed identifier or length\n");
+  if (!header_size)
+    return 0;
+  if (len == LENGTH_INDEFINITE) {
+    eoc = ber_eoc_find(Global.data + header_size, array_end(Global.data_begin));
+    return eoc ? eoc + 2 : 0;
+  }
+  return len <= left - header_size ? Global.data + header_size + len : 0;
+}
 
-      /* otherwise print as hex */
-      printf("%s0x", GREEN);
-      for (i = 0; i < object->data.string.len; ++i) {
-        if (i >= 20) {
-          printf("%s...\n", NORMAL);
-          break;
-        }
-        printf("%.2x", object->data.string.value[i]);
-      }
-      printf("%s\n", NORMAL);
+static void follow_all(ASN1_Typedef *start_type, const char *path, int poll_ms) {
+  static unsigned char buffer[1 << 16];
+  struct pollfd pfd;
+  struct stat st;
+  unsigned char *end;
+  size_t n;
+  FILE *f;
+  int o;
 
-    } break;
+  f = fopen(path, "rb");
+  if (!f)
+    die("Failed to open %s: %s\n", path, strerror(errno));
+  Global.filename = path;
 
-    case TYPE_PRINTABLE_STRING:
-    case TYPE_IA5_STRING:
-    case TYPE_UTF8_STRING:
-      if (object->name)
-        printf(TABS "%s%s%s ", TAB(indent), NORMAL, object->name, NORMAL);
-      printf("%s\"%.*s\"%s\n", BLUE, object->data.string.len, object->data.string.value, NORMAL);
-      break;
+  /* inotify wakes us up as soon as the file is written to. Without it, or on file systems that don't tell it
+   * about writes from other machines, like NFS, we look again every poll_ms */
+  pfd.fd = inotify_init1(IN_NONBLOCK);
+  pfd.events = POLLIN;
+  if (pfd.fd >= 0 && inotify_add_watch(pfd.fd, path, IN_MODIFY) < 0)
+    close(pfd.fd), pfd.fd = -1;
 
-    default:
-      print_error("Type not supported:\n");
-      print_definition(object->type, 0);
-      exit(1);
-  }
-}
+  for (;;) {
+    /* read what was appended, a chunk at a time, so what was already in a large file isn't all read in at once */
+    n = fread(buffer, 1, sizeof(buffer), f);
+    array_push_a(Global.data_begin, buffer, n);
+
+    Global.data = Global.data_begin;
+    while ((end = follow_record_end())) {
+      array_resize(Global.objects, 0);
+      o = decode(start_type->type, start_type->name, 0, 0, 0, 0);
+      dump_object_tree(o, 0);
+      Global.data = end;
+    }
+    fflush(stdout);
+
+    /* drop what was printed, and keep the start of the unfinished record */
+    Global.data_offset += Global.data - Global.data_begin;
+    array_remove_slow_n(Global.data_begin, 0, Global.data - Global.data_begin);
+    Global.data = Global.data_begin;
+    if (n == sizeof(buffer))
+      continue;
+    clearerr(f);
+
+    /* truncated, like by a logrotate copytruncate, so it starts over */
+    if (!fstat(fileno(f), &st) && st.st_size < ftell64(f)) {
+      fprintf(stderr, "%s: truncated, decoding it from the start\n", path);
+      rewind(f);
+      array_resize(Global.data_begin, 0);
+      Global.data_offset = 0;
+      continue;
+    }
 
-static void dump_all(ASN1_Typedef *start_type) {
-  while (Global.data < array_end(Global.data_begin)) {
-    Object *o = decode(start_type->type, start_type->name, 0, 0, 0);
-    dump_object_tree(o, 0, 0);
+    if (poll(&pfd, pfd.fd >= 0, poll_ms) > 0)
+      while (read(pfd.fd, buffer, sizeof(buffer)) > 0);
   }
 }
+#endif /* COMPILE_WATCH_MODE */
 
 int main(int argc, const char **argv) {
   ASN1_Typedef *start_type;
@@ -1518,7 +3854,16 @@ int main(int argc, const char **argv) {
   const char *type_name;
   int num_input_files;
   int interactive = 0;
-  int num_opts = 0;
+  int validate_only = 0;
+  int stream = 0;
+  int compile = 0;
+  int schema_stats = 0;
+  SchemaOptions schema_options = {0};
+  const char *batch_dir = 0, *output_dir = 0, *serve_path = 0, *connect_path = 0, *watch_dir = 0, *journal_path = 0;
+  int jobs = 0;
+  int follow = 0, poll_ms = 1000;
+  int num_opts = 0, has_binary, has_type_name;
+  char *end;
   int i;
 
   init_colors();
@@ -1533,6 +3878,61 @@ int main(int argc, const char **argv) {
     if (is_option(argv[i])) {
       if (strcmp(argv[i], "--interactive") == 0)
         interactive = 1;
+      else if (strcmp(argv[i], "--validate") == 0)
+        validate_only = 1;
+      else if (strcmp(argv[i], "--count-violations") == 0)
+        Global.count_violations = 1;
+      else if (strcmp(argv[i], "--stream") == 0)
+        stream = 1;
+      else if (strcmp(argv[i], "--follow") == 0)
+        follow = 1;
+      else if (strncmp(argv[i], "--poll=", 7) == 0)
+        poll_ms = option_number(argv[i], argv[i] + 7, 1);
+      else if (strcmp(argv[i], "--compile-schema") == 0)
+        compile = 1;
+      else if (strcmp(argv[i], "--schema-stats") == 0)
+        schema_stats = 1;
+      else if (strncmp(argv[i], "--module-path=", 14) == 0)
+        asn1_module_path_add(argv[i] + 14);
+      else if (strncmp(argv[i], "--contains=", 11) == 0)
+        array_push(schema_options.contains, argv[i] + 11);
+      else if (strncmp(argv[i], "--display-hints=", 16) == 0)
+        array_push(schema_options.display_hints, argv[i] + 16);
+      else if (strcmp(argv[i], "--lazy-contents") == 0)
+        Global.lazy_contents = 1;
+      else if (strcmp(argv[i], "--full-values") == 0)
+        Global.full_values = 1;
+      else if (strncmp(argv[i], "--skip=", 7) == 0)
+        record_selection.skip = option_number(argv[i], argv[i] + 7, 0);
+      else if (strncmp(argv[i], "--every=", 8) == 0)
+        record_selection.every = option_number(argv[i], argv[i] + 8, 1);
+      else if (strncmp(argv[i], "--limit=", 8) == 0)
+        record_selection.limit = option_number(argv[i], argv[i] + 8, 0);
+      else if (strncmp(argv[i], "--sample=", 9) == 0) {
+        record_selection.sample = strtod(argv[i] + 9, &end);
+        if (*end || end == argv[i] + 9 || !(record_selection.sample > 0 && record_selection.sample <= 1))
+          fprintf(stderr, "Expected a number above 0 and at most 1 in %s\n", argv[i]), exit(1);
+      }
+      else if (strncmp(argv[i], "--seed=", 7) == 0)
+        record_selection.random = option_number(argv[i], argv[i] + 7, 0) | 1;
+      else if (strncmp(argv[i], "--batch=", 8) == 0)
+        batch_dir = argv[i] + 8;
+      else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        jobs = option_number(argv[i], argv[i] + 7, 1);
+      else if (strncmp(argv[i], "--output-dir=", 13) == 0)
+        output_dir = argv[i] + 13;
+      else if (strncmp(argv[i], "--watch=", 8) == 0)
+        watch_dir = argv[i] + 8;
+      else if (strncmp(argv[i], "--journal=", 10) == 0)
+        journal_path = argv[i] + 10;
+      else if (strncmp(argv[i], "--serve=", 8) == 0)
+        serve_path = argv[i] + 8;
+      else if (strncmp(argv[i], "--connect=", 10) == 0)
+        connect_path = argv[i] + 10;
+      else if (strncmp(argv[i], "--grep=", 7) == 0) {
+        if (!needle_parse(argv[i] + 7))
+          fprintf(stderr, "Expected hex:BYTES, tbcd:DIGITS with at least 2 digits, or text:TEXT in %s\n", argv[i]), exit(1);
+      }
       else {
         printf("Unknown option \"%s\"\n", argv[i]+2);
         print_usage(), exit(1);
@@ -1541,19 +3941,47 @@ int main(int argc, const char **argv) {
     }
   }
 
-  if (argc - num_opts < 3)
+  if (compile)
+    return compile_schema(argc, argv);
+
+  if ((stream || validate_only) && (record_selection.skip || record_selection.every > 1 || record_selection.limit >= 0 || record_selection.sample || record_selection.needle))
+    fprintf(stderr, "--skip, --every, --limit, --sample and --grep can't be used with --stream or --validate\n"), exit(1);
+
+  if ((batch_dir || serve_path || connect_path || watch_dir) && (interactive || stream))
+    fprintf(stderr, "--batch, --serve, --connect and --watch can't be used with --interactive or --stream\n"), exit(1);
+
+  /* in batch mode the binaries come from --batch, the server gets them and the type names with each request,
+   * and the client leaves the schema to the server */
+  if (follow && (interactive || stream || validate_only || Global.count_violations || batch_dir || serve_path || connect_path || watch_dir ||
+                 record_selection.skip || record_selection.every > 1 || record_selection.limit >= 0 || record_selection.sample || record_selection.needle))
+    fprintf(stderr, "--follow can only be used with the options for the schema\n"), exit(1);
+  if (watch_dir && (validate_only || Global.count_violations || batch_dir || serve_path || connect_path ||
+                    record_selection.skip || record_selection.every > 1 || record_selection.limit >= 0 || record_selection.sample || record_selection.needle))
+    fprintf(stderr, "--watch can only be used with --journal and the options for the schema\n"), exit(1);
+
+  has_binary = !batch_dir && !serve_path && !watch_dir;
+  has_type_name = !serve_path;
+  num_input_files = argc - num_opts - has_binary - has_type_name;
+  if (connect_path ? num_input_files != 0 : num_input_files < 1)
     print_usage(), exit(1);
+  if (!jobs) {
+    #ifdef COMPILE_BATCH_MODE
+      jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    #else
+      jobs = 1;
+    #endif
+  }
 
   /* get our args */
   i = 0;
   /* input files */
-  input_files = malloc(sizeof(*input_files) * (argc - num_opts - 2));
-  for (num_input_files = 0; num_input_files < (argc - num_opts - 2); ++i)
+  input_files = malloc(sizeof(*input_files) * (num_input_files + 1));
+  for (num_input_files = 0; num_input_files < (argc - num_opts - has_binary - has_type_name); ++i)
     if (!is_option(argv[i]))
       input_files[num_input_files++] = argv[i];
 
   /* binary */
-  for (; i < argc; ++i) {
+  for (; i < argc && has_binary; ++i) {
     if (!is_option(argv[i])) {
       binary_file = argv[i++];
       break;
@@ -1561,21 +3989,87 @@ int main(int argc, const char **argv) {
   }
 
   /* type name */
-  for (; i < argc; ++i) {
+  for (; i < argc && has_type_name; ++i) {
     if (!is_option(argv[i])) {
       type_name = argv[i++];
       break;
     }
   }
 
-  Global.types = asn1_parse(input_files, num_input_files);
+  #ifdef COMPILE_BATCH_MODE
+    if (connect_path)
+      return run_client(connect_path, binary_file, type_name, validate_only);
+  #endif
+
+  Global.types = schema_load(input_files, num_input_files, &schema_options);
   if (!Global.types)
     die("Failed parsing\n");
 
+  /* the types are kept whole, since any of them can be asked for */
+  if (serve_path) {
+    #ifdef COMPILE_BATCH_MODE
+      run_server(serve_path, jobs > 0 ? jobs : 1);
+    #else
+      fprintf(stderr, "Server mode not supported on your platform\n");
+      exit(1);
+    #endif
+  }
+
   start_type = get_type_by_name(type_name);
   if (!start_type)
     die("Found no type '%s' in definition\n", type_name);
 
+  /* drop the types we will never get to */
+  {
+    Array(const char*) roots = 0;
+    SchemaStats before, after;
+
+    array_push(roots, type_name);
+    Global.types = asn1_prune(Global.types, roots, array_len(roots), schema_stats ? &before : 0, &after);
+    array_free(roots);
+    start_type = get_type_by_name(type_name);
+    if (schema_stats)
+      print_schema_stats(stderr, &before, &after);
+  }
+
+  if (watch_dir) {
+    #ifdef COMPILE_WATCH_MODE
+      run_watch(start_type, watch_dir, journal_path);
+    #else
+      fprintf(stderr, "Watch mode not supported on your platform\n");
+      exit(1);
+    #endif
+  }
+
+  if (follow) {
+    #ifdef COMPILE_WATCH_MODE
+      follow_all(start_type, binary_file, poll_ms);
+    #else
+      fprintf(stderr, "Follow mode not supported on your platform\n");
+      exit(1);
+    #endif
+  }
+
+  if (batch_dir) {
+    #ifdef COMPILE_BATCH_MODE
+      return run_batch(start_type, batch_dir, output_dir, jobs > 0 ? jobs : 1, validate_only) ? 1 : 0;
+    #else
+      fprintf(stderr, "Batch mode not supported on your platform\n");
+      exit(1);
+    #endif
+  }
+
+  if (stream) {
+    FILE *f;
+
+    f = strcmp(binary_file, "-") == 0 ? stdin : fopen(binary_file, "rb");
+    if (!f)
+      die("Failed to open %s: %s\n", binary_file, strerror(errno));
+    stream_all(start_type, f);
+    print_violations();
+    return 0;
+  }
+
   /* read file */
 
   Global.data_begin = Global.data = file_get_contents(binary_file);
@@ -1584,6 +4078,9 @@ int main(int argc, const char **argv) {
     die("Failed to read contents of %s: %s\n", binary_file, strerror(errno));
 
 
+  if (validate_only)
+    return validate_all(start_type) ? 2 : 0;
+
   /* interactive mode ? */
   if (interactive) {
     #ifdef COMPILE_INTERACTIVE_MODE
@@ -1595,4 +4092,6 @@ int main(int argc, const char **argv) {
   }
   else
     dump_all(start_type);
+
+  print_violations();
 }
@@ -8,6 +8,17 @@ typedef struct TypedefHeader TypedefHeader;
 typedef struct ASN1_Typedef ASN1_Typedef;
 typedef union ASN1_Type ASN1_Type;
 typedef struct Tag Tag;
+typedef struct Constraint Constraint;
+typedef struct NamedNumber NamedNumber;
+typedef struct NameTable NameTable;
+typedef struct ParseContext ParseContext;
+typedef struct ASN1_Module ASN1_Module;
+
+/* the reentrant flex scanner, which y.tab.h needs before the lexer defines it */
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
 
 enum Type {
   TYPE_UNKNOWN,
@@ -34,6 +45,35 @@ enum {
   TAG_NO_ID = -1
 };
 
+/* How the value of an OCTET STRING or BIT STRING field is shown */
+enum {
+  DISPLAY_GUESS, /* from what the value looks like */
+  DISPLAY_IP,
+  DISPLAY_TIME, /* milliseconds since 1970 */
+  DISPLAY_TBCD,
+  DISPLAY_INTEGER,
+  DISPLAY_HEX,
+  DISPLAY_TEXT
+};
+
+enum {
+  CONSTRAINT_SIZE = 1,
+  CONSTRAINT_HAS_MIN = 2,
+  CONSTRAINT_HAS_MAX = 4,
+  CONSTRAINT_EXTENSIBLE = 8 /* has a '...', so values outside the bounds are allowed */
+};
+
+/* A SIZE or value range constraint, like (SIZE(1..8)) or (0..255)
+ * For SIZE constraints, the bounds apply to the number of bytes, bits, characters or items depending on the type */
+struct Constraint {
+  unsigned int flags;
+  long long min, max;
+  /* only used during parsing phase, for bounds given by name, and the module they are looked up in.
+   * All names have been resolved when parse() returns */
+  char *min_name, *max_name;
+  ASN1_Module *module;
+};
+
 struct ASN1_Typedef {
   char *name;
   ASN1_Type *type;
@@ -47,6 +87,22 @@ struct Tag {
   unsigned int flags;
 };
 
+/* An entry in an ENUMERATED, a named INTEGER or a named BIT STRING, like red(1) */
+struct NamedNumber {
+  char *name;
+  long long value;
+};
+
+/* Named numbers compiled for lookup by value.
+ * If the values are close together, names[value - min] gives the name directly (0 if there is none),
+ * otherwise numbers is sorted by value and searched */
+struct NameTable {
+  long long min;
+  Array(char*) names;
+  Array(NamedNumber) numbers;
+  int extensible;
+};
+
 union ASN1_Type {
   Type type;
 
@@ -63,22 +119,91 @@ union ASN1_Type {
   struct {
     Type type;
     ASN1_Type *item_type;
+    Constraint *constraint;
   } list;
 
+  /* BOOLEAN, INTEGER, ENUMERATED and the string types */
+  struct {
+    Type type;
+    Constraint *constraint;
+    /* for ENUMERATED, and INTEGER or BIT STRING with named numbers or bits */
+    NameTable *names;
+    /* for OCTET STRING and BIT STRING, the type encoded in the value, if any */
+    ASN1_Type *contains;
+    /* for OCTET STRING and BIT STRING, one of DISPLAY_* */
+    int display;
+  } primitive;
+
   struct {
     Type type;
     char *reference_name;
+    Constraint *constraint;
+    /* the module it was used in, which decides what the name means */
+    ASN1_Module *module;
+    /* the type node this reference stands for, once resolved */
+    ASN1_Type *resolved;
   } reference;
 };
 
 Tag asn1_tag_create(char *name, int id, ASN1_Type *type, unsigned int flags);
-ASN1_Type *asn1_choice_create(Array(Tag) choices);
-ASN1_Type *asn1_sequence_create(Array(Tag) items);
+ASN1_Type *asn1_choice_create(ParseContext *ctx, Array(Tag) choices);
+ASN1_Type *asn1_sequence_create(ParseContext *ctx, Array(Tag) items);
 ASN1_Type *asn1_type_create(char *name, ASN1_Type *base);
-ASN1_Type *asn1_list_create(ASN1_Type *type);
+ASN1_Type *asn1_list_create(ParseContext *ctx, ASN1_Type *type);
+ASN1_Type *asn1_constrained_create(ParseContext *ctx, ASN1_Type *base, Constraint *constraint);
+Constraint *asn1_constraint_create(ParseContext *ctx, unsigned int flags, long long min, char *min_name, long long max, char *max_name);
+Constraint *asn1_type_constraint(ASN1_Type *type);
+void asn1_value_create(ParseContext *ctx, char *name, long long value);
+ASN1_Type *asn1_named_create(ParseContext *ctx, ASN1_Type *base, Array(NamedNumber) numbers, int extensible);
+ASN1_Type *asn1_containing_create(ParseContext *ctx, ASN1_Type *base, ASN1_Type *contains);
+const char *asn1_name_lookup(NameTable *table, long long value);
 ASN1_Typedef *asn1_typedef_create(ASN1_Type *type, char *name);
+void asn1_typedef_add(ParseContext *ctx, ASN1_Typedef *t);
+void asn1_module_begin(ParseContext *ctx, char *name);
+void asn1_import_add(ParseContext *ctx, Array(char*) names, char *module);
+/* Adds a directory to look in for imported modules, that were not given to asn1_parse() */
+void asn1_module_path_add(const char *dir);
+/* All files asn1_parse() has parsed, including the imported modules it found */
+Array(const char*) asn1_parsed_files(void);
+/* The types of the given files, and the types of imported modules that they use */
 Array(ASN1_Typedef) asn1_parse(const char **filenames, int num_files);
+/* Looks up a type in the array returned by asn1_parse() */
+ASN1_Typedef *asn1_find_type(Array(ASN1_Typedef) parsed_types, const char *name);
+/* Makes asn1_find_type() look in types that were not parsed */
+void asn1_index_types(Array(ASN1_Typedef) parsed_types);
+/* The fields at path, which is either a field name, for every field by that name, or Type.field.field...
+ * If path is 0, it gives every field in the schema */
+Array(Tag*) asn1_fields_find(Array(ASN1_Typedef) parsed_types, const char *path);
+/* The OCTET or BIT STRING type of a field, or of its items if it is a SEQUENCE OF them, or 0 if it has none.
+ * The type is copied for the field first, so that changing it changes only that field */
+ASN1_Type *asn1_field_string(Tag *field);
+/* Makes the OCTET or BIT STRING fields at path hold an encoded type_name.
+ * Returns the number of fields changed, or -1 if type_name is not defined */
+int asn1_contains_set(Array(ASN1_Typedef) parsed_types, const char *path, const char *type_name);
+
+typedef struct {
+  int types, nodes, tags;
+} SchemaStats;
+
+/* Keeps only the typedefs reachable from the named root types, and frees the parsed types that are left unreachable.
+ * before may be 0, which saves walking the whole schema */
+Array(ASN1_Typedef) asn1_prune(Array(ASN1_Typedef) parsed_types, const char **roots, int num_roots, SchemaStats *before, SchemaStats *after);
+
+/* What a schema was compiled with besides its source files, so that it can be compiled again the same way */
+typedef struct {
+  /* the types it was pruned to, if any */
+  Array(const char*) roots;
+  /* PATH=TYPE arguments to asn1_contains_set() */
+  Array(const char*) contains;
+  /* files that say how fields are shown */
+  Array(const char*) display_hints;
+} SchemaOptions;
+
+/* Compiled schemas. asn1_schema_save() returns nonzero on failure.
+ * If any of the source files changed since the schema was compiled, asn1_schema_load() returns 0 and gives the source files and options instead */
+int asn1_schema_save(Array(ASN1_Typedef) parsed_types, const char **filenames, int num_files, SchemaOptions *options, const char *path);
+int asn1_schema_is_compiled(const char *path);
+Array(ASN1_Typedef) asn1_schema_load(const char *path, Array(char*) *stale_sources, SchemaOptions *stale_options);
 
-int yywrap(void);
 
 #endif /* DEFS_H */
@@ -1,7 +1,20 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if !defined(_WIN32) && !defined(_WIN64)
+  #define PARSE_IN_PARALLEL
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <pthread.h>
+#endif
 #include "array.h"
+#include "symtab.h"
 #include "defs.h"
 
 static ASN1_Type asn1_null_type;
@@ -12,21 +25,72 @@ static ASN1_Type asn1_bit_string_type;
 static ASN1_Type asn1_utf8_string_type;
 static ASN1_Type asn1_ia5_string_type;
 static ASN1_Type asn1_printable_string_type;
+static ASN1_Type asn1_enumerated_type;
 
-static Array(ASN1_Typedef*) types;
-static Array(ASN1_Type*) type_references;
+typedef struct {
+  char *name;
+  long long value;
+} ASN1_Value;
 
-extern FILE *yyin;
+typedef struct {
+  char *name;
+  char *module;
+} ASN1_Import;
 
-int yyparse(void);
-int yylex(void);
-extern int yylineno;
-static const char *current_file;
+struct ASN1_Module {
+  char *name;
+  const char *filename;
+  Array(ASN1_Typedef*) types;
+  /* from type name to its index in types */
+  SymbolTable table;
+  Array(ASN1_Import) imports;
+  /* from imported name to its index in imports */
+  SymbolTable import_table;
+  Array(ASN1_Value) values;
+  /* from value name to its index in values */
+  SymbolTable value_table;
+};
 
-static ASN1_Type *type_alloc(ASN1_Type in) {
+/* Everything made while parsing a file. Each file gets its own, so that they can be parsed at the same time,
+ * and they are merged into schema when all are done */
+struct ParseContext {
+  const char *filename;
+  Array(ASN1_Module*) modules;
+  /* the module being parsed */
+  ASN1_Module *module;
+  Array(ASN1_Typedef*) types;
+  /* every type node created */
+  Array(ASN1_Type*) type_nodes;
+  Array(Constraint*) constraints;
+  Array(ASN1_Value) values;
+};
+
+static ParseContext schema;
+/* from type name to its index in schema.types */
+static SymbolTable type_table;
+/* from module name to its index in schema.modules */
+static SymbolTable module_table;
+/* from value name to its index in schema.values */
+static SymbolTable value_table;
+/* where to look for modules that are imported but weren't given */
+static Array(const char*) module_path;
+static Array(const char*) parsed_files;
+
+/* the reentrant flex interface, the scanner's extra data is the ParseContext */
+int yylex_init_extra(void *extra, yyscan_t *scanner);
+int yylex_destroy(yyscan_t scanner);
+void yyset_in(FILE *in, yyscan_t scanner);
+void *yyget_extra(yyscan_t scanner);
+int yyget_lineno(yyscan_t scanner);
+int yyparse(yyscan_t scanner);
+
+#define CTX ((ParseContext*)yyget_extra(scanner))
+
+static ASN1_Type *type_alloc(ParseContext *ctx, ASN1_Type in) {
   ASN1_Type *t;
   t = malloc(sizeof(*t));
   *t = in;
+  array_push(ctx->type_nodes, t);
   return t;
 }
 
@@ -38,32 +102,164 @@ ASN1_Typedef *asn1_typedef_create(ASN1_Type *type, char *name) {
   return t;
 }
 
-ASN1_Type *asn1_typeref_create(char *name) {
+void asn1_module_begin(ParseContext *ctx, char *name) {
+  ASN1_Module *m;
+  m = calloc(1, sizeof(*m));
+  m->name = name;
+  m->filename = ctx->filename;
+  array_push(ctx->modules, m);
+  ctx->module = m;
+}
+
+void asn1_typedef_add(ParseContext *ctx, ASN1_Typedef *t) {
+  array_push(ctx->types, t);
+  symtab_add(&ctx->module->table, t->name, array_len(ctx->module->types));
+  array_push(ctx->module->types, t);
+}
+
+void asn1_import_add(ParseContext *ctx, Array(char*) names, char *module) {
+  ASN1_Import import;
+  char **name;
+
+  array_foreach(names, name) {
+    import.name = *name;
+    import.module = module;
+    symtab_add(&ctx->module->import_table, *name, array_len(ctx->module->imports));
+    array_push(ctx->module->imports, import);
+  }
+  array_free(names);
+}
+
+ASN1_Type *asn1_typeref_create(ParseContext *ctx, char *name) {
   ASN1_Type t = {0};
   t.type = _TYPE_REFERENCE;
   t.reference.reference_name = name;
-  return type_alloc(t);
+  t.reference.module = ctx->module;
+  return type_alloc(ctx, t);
 }
 
-ASN1_Type *asn1_choice_create(Array(Tag) choices) {
+ASN1_Type *asn1_choice_create(ParseContext *ctx, Array(Tag) choices) {
   ASN1_Type t = {0};
   t.type = TYPE_CHOICE;
   t.choice.choices = choices;
-  return type_alloc(t);
+  return type_alloc(ctx, t);
 }
 
-ASN1_Type *asn1_list_create(ASN1_Type *type) {
+ASN1_Type *asn1_list_create(ParseContext *ctx, ASN1_Type *type) {
   ASN1_Type r = {0};
   r.type = TYPE_LIST;
   r.list.item_type = type;
-  return type_alloc(r);
+  return type_alloc(ctx, r);
 }
 
-ASN1_Type *asn1_sequence_create(Array(Tag) items) {
+ASN1_Type *asn1_sequence_create(ParseContext *ctx, Array(Tag) items) {
   ASN1_Type r = {0};
   r.type = TYPE_SEQUENCE;
   r.sequence.items = items;
-  return type_alloc(r);
+  return type_alloc(ctx, r);
+}
+
+ASN1_Type *asn1_constrained_create(ParseContext *ctx, ASN1_Type *base, Constraint *constraint) {
+  ASN1_Type t = *base;
+  t.primitive.constraint = constraint;
+  return type_alloc(ctx, t);
+}
+
+Constraint *asn1_constraint_create(ParseContext *ctx, unsigned int flags, long long min, char *min_name, long long max, char *max_name) {
+  Constraint *c;
+  c = malloc(sizeof(*c));
+  c->flags = flags;
+  c->min = min;
+  c->max = max;
+  c->min_name = min_name;
+  c->max_name = max_name;
+  c->module = ctx->module;
+  if (!min_name)
+    c->flags |= CONSTRAINT_HAS_MIN;
+  if (!max_name)
+    c->flags |= CONSTRAINT_HAS_MAX;
+  array_push(ctx->constraints, c);
+  return c;
+}
+
+Constraint *asn1_type_constraint(ASN1_Type *type) {
+  switch (type->type) {
+    case TYPE_UNKNOWN:
+    case TYPE_NULL:
+    case TYPE_SEQUENCE:
+    case TYPE_CHOICE:
+      return 0;
+    case TYPE_LIST:
+      return type->list.constraint;
+    case _TYPE_REFERENCE:
+      return type->reference.constraint;
+    default:
+      return type->primitive.constraint;
+  }
+}
+
+static int named_number_cmp(const void *a, const void *b) {
+  long long x = ((const NamedNumber*)a)->value, y = ((const NamedNumber*)b)->value;
+  return x < y ? -1 : x > y;
+}
+
+ASN1_Type *asn1_named_create(ParseContext *ctx, ASN1_Type *base, Array(NamedNumber) numbers, int extensible) {
+  ASN1_Type t = *base;
+  NameTable *table;
+  long long range;
+  int i;
+
+  table = malloc(sizeof(*table));
+  table->names = 0;
+  table->numbers = numbers;
+  table->extensible = extensible;
+
+  qsort(numbers, array_len(numbers), sizeof(*numbers), named_number_cmp);
+  table->min = numbers[0].value;
+  range = array_last(numbers)->value - table->min + 1;
+
+  /* use a direct lookup table, unless it would be mostly holes */
+  if (range <= 2*array_len(numbers) + 16) {
+    array_resize(table->names, (int)range);
+    memset(table->names, 0, range * sizeof(*table->names));
+    for (i = 0; i < array_len(numbers); ++i)
+      table->names[numbers[i].value - table->min] = numbers[i].name;
+  }
+
+  t.primitive.names = table;
+  return type_alloc(ctx, t);
+}
+
+ASN1_Type *asn1_containing_create(ParseContext *ctx, ASN1_Type *base, ASN1_Type *contains) {
+  ASN1_Type t = *base;
+  t.primitive.contains = contains;
+  return type_alloc(ctx, t);
+}
+
+const char *asn1_name_lookup(NameTable *table, long long value) {
+  int lo, hi, mid;
+
+  if (table->names)
+    return value >= table->min && value - table->min < array_len(table->names) ? table->names[value - table->min] : 0;
+
+  lo = 0, hi = array_len(table->numbers);
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (table->numbers[mid].value < value)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo < array_len(table->numbers) && table->numbers[lo].value == value ? table->numbers[lo].name : 0;
+}
+
+void asn1_value_create(ParseContext *ctx, char *name, long long value) {
+  ASN1_Value v;
+  v.name = name;
+  v.value = value;
+  array_push(ctx->values, v);
+  symtab_add(&ctx->module->value_table, name, array_len(ctx->module->values));
+  array_push(ctx->module->values, v);
 }
 
 Tag asn1_tag_create(char *name, int id, ASN1_Type *type, unsigned int flags) {
@@ -75,12 +271,8 @@ Tag asn1_tag_create(char *name, int id, ASN1_Type *type, unsigned int flags) {
   return t;
 }
 
-int yywrap(void) {
-  return 1;
-}
-
-static void yyerror(const char *str) {
-  fprintf(stderr, "error %s:%i: %s\n", current_file, yylineno, str);
+static void yyerror(yyscan_t scanner, const char *str) {
+  fprintf(stderr, "error %s:%i: %s\n", CTX->filename, yyget_lineno(scanner), str);
   exit(1);
 }
 
@@ -93,81 +285,543 @@ static void builtin_types_init(void) {
   asn1_utf8_string_type.type = TYPE_UTF8_STRING;
   asn1_ia5_string_type.type = TYPE_IA5_STRING;
   asn1_printable_string_type.type = TYPE_PRINTABLE_STRING;
+  asn1_enumerated_type.type = TYPE_ENUM;
 }
 
-static int asn1_resolve_reference_type(ASN1_Type *type) {
-  int err;
-  ASN1_Typedef **match;
+static ASN1_Value *asn1_lookup_value(ASN1_Module *m, const char *name);
 
-  if (type->type != _TYPE_REFERENCE)
+/* Looks up a named bound, like the maxFoo in (SIZE(1..maxFoo)). MIN and MAX mean no bound */
+static int asn1_resolve_constraint_bound(Constraint *c, char *name, long long *bound, unsigned int flag) {
+  ASN1_Value *v;
+
+  if (!strcmp(name, "MIN") || !strcmp(name, "MAX"))
     return 0;
 
-  array_find(types, match, !strcmp((*match)->name, type->reference.reference_name))
-  if (!match) {
-    fprintf(stderr, "Type '%s' does not exist\n", type->reference.reference_name);
+  v = asn1_lookup_value(c->module, name);
+  if (!v) {
+    fprintf(stderr, "Value '%s' used in constraint does not exist\n", name);
     return 1;
   }
+  *bound = v->value;
+  c->flags |= flag;
+  return 0;
+}
 
-  err = asn1_resolve_reference_type((*match)->type);
-  if (err)
+static int asn1_resolve_constraint(Constraint *c) {
+  if (c->min_name && asn1_resolve_constraint_bound(c, c->min_name, &c->min, CONSTRAINT_HAS_MIN))
     return 1;
-  *type = *(*match)->type;
+  if (c->max_name && asn1_resolve_constraint_bound(c, c->max_name, &c->max, CONSTRAINT_HAS_MAX))
+    return 1;
+  c->min_name = c->max_name = 0;
+  c->module = 0;
   return 0;
 }
 
-Array(ASN1_Typedef) asn1_parse(const char **filenames, int num_files) {
-  int i = 0;
+static void asn1_parse_files(const char **filenames, int num_files);
+
+void asn1_module_path_add(const char *dir) {
+  array_push(module_path, dir);
+}
+
+Array(const char*) asn1_parsed_files(void) {
+  return parsed_files;
+}
+
+static char *asn1_path_join(const char *dir, const char *name, const char *extension) {
+  char *path;
+  path = malloc(strlen(dir) + strlen(name) + strlen(extension) + 2);
+  sprintf(path, "%s/%s%s", dir, name, extension);
+  return path;
+}
+
+/* Looks for a file in dir that starts with the definition of the module */
+static char *asn1_module_scan(const char *dir, const char *name) {
+  char buf[4096], *path, *p, *ext;
+  struct dirent *entry;
+  size_t n, len;
+  DIR *d;
   FILE *f;
-  Array(ASN1_Typedef) result = 0;
 
-  /* parse each file */
-  for (; num_files; --num_files, ++filenames) {
-    f = fopen(*filenames, "rb");
-    if (!f) {
-      fprintf(stderr, "Could not find file '%s': %s\n", *filenames, strerror(errno));
-      exit(1);
+  d = opendir(dir);
+  if (!d)
+    return 0;
+  len = strlen(name);
+  while ((entry = readdir(d))) {
+    ext = strrchr(entry->d_name, '.');
+    if (!ext || (strcmp(ext, ".asn") && strcmp(ext, ".asn1") && strcmp(ext, ".ASN") && strcmp(ext, ".ASN1")))
+      continue;
+
+    path = asn1_path_join(dir, entry->d_name, "");
+    f = fopen(path, "rb");
+    n = f ? fread(buf, 1, sizeof(buf)-1, f) : 0;
+    if (f)
+      fclose(f);
+    buf[n] = 0;
+
+    /* skip whitespace and comments */
+    for (p = buf; *p;) {
+      if (isspace((unsigned char)*p))
+        ++p;
+      else if (p[0] == '-' && p[1] == '-')
+        for (p += 2; *p && *p != '\n'; ++p);
+      else
+        break;
+    }
+    if (!strncmp(p, name, len) && !isalnum((unsigned char)p[len]) && p[len] != '-' && p[len] != '_') {
+      closedir(d);
+      return path;
     }
+    free(path);
+  }
+  closedir(d);
+  return 0;
+}
 
-    builtin_types_init();
+/* Finds the file of a module in the module path, first by its file name, then by what the files define */
+static char *asn1_module_find(const char *name) {
+  static const char *extensions[] = {".asn", ".asn1", ".ASN", ".ASN1"};
+  const char **dir;
+  char *path;
+  FILE *f;
+  int i;
 
-    yyin = f;
-    current_file = *filenames;
+  array_foreach(module_path, dir) {
+    for (i = 0; i < (int)(sizeof(extensions)/sizeof(*extensions)); ++i) {
+      path = asn1_path_join(*dir, name, extensions[i]);
+      f = fopen(path, "rb");
+      if (f) {
+        fclose(f);
+        return path;
+      }
+      free(path);
+    }
+  }
+  array_foreach(module_path, dir) {
+    path = asn1_module_scan(*dir, name);
+    if (path)
+      return path;
+  }
+  return 0;
+}
 
-    yyparse();
+/* Gets a module by name, parsing it first if it hasn't been */
+static ASN1_Module *asn1_module_get(const char *name) {
+  char *path;
+  int i;
 
-    fclose(f);
+  i = symtab_find(&module_table, name);
+  if (i >= 0)
+    return schema.modules[i];
+
+  path = asn1_module_find(name);
+  if (!path) {
+    fprintf(stderr, "Module '%s' is imported, but was not found in the module path\n", name);
+    exit(1);
+  }
+  asn1_parse_files((const char**)&path, 1);
+
+  i = symtab_find(&module_table, name);
+  if (i < 0) {
+    fprintf(stderr, "Expected %s to define module '%s', but it doesn't\n", path, name);
+    exit(1);
+  }
+  return schema.modules[i];
+}
+
+/* Finds a type defined in, or imported by, a module. Imports can be imported in turn, up to a limit, in case modules import from each other in a circle */
+static ASN1_Typedef *asn1_module_lookup(ASN1_Module *m, const char *name, int depth) {
+  int i;
+
+  i = symtab_find(&m->table, name);
+  if (i >= 0)
+    return m->types[i];
+  i = symtab_find(&m->import_table, name);
+  if (i < 0 || depth > 16)
+    return 0;
+  return asn1_module_lookup(asn1_module_get(m->imports[i].module), name, depth+1);
+}
+
+/* Finds a value defined in, or imported by, a module, like asn1_module_lookup() does for types */
+static ASN1_Value *asn1_module_value(ASN1_Module *m, const char *name, int depth) {
+  int i;
+
+  i = symtab_find(&m->value_table, name);
+  if (i >= 0)
+    return m->values + i;
+  i = symtab_find(&m->import_table, name);
+  if (i < 0 || depth > 16)
+    return 0;
+  return asn1_module_value(asn1_module_get(m->imports[i].module), name, depth+1);
+}
+
+/* Finds the value a name used in module m refers to */
+static ASN1_Value *asn1_lookup_value(ASN1_Module *m, const char *name) {
+  ASN1_Value *v;
+  int i;
+
+  v = m ? asn1_module_value(m, name, 0) : 0;
+  if (v)
+    return v;
+  i = symtab_find(&value_table, name);
+  return i < 0 ? 0 : schema.values + i;
+}
+
+/* Finds what a name used in module m refers to */
+static ASN1_Typedef *asn1_lookup(ASN1_Module *m, const char *name) {
+  ASN1_Typedef *t;
+  int i;
+
+  t = m ? asn1_module_lookup(m, name, 0) : 0;
+  if (t)
+    return t;
+  /* for schemas without IMPORTS, any of the given modules will do */
+  i = symtab_find(&type_table, name);
+  return i < 0 ? 0 : schema.types[i];
+}
+
+/* Returns the type node a reference stands for, or 0 on error.
+ * Chains of typedefs like A ::= B are followed, and all references to a type end up sharing its node */
+static ASN1_Type *asn1_resolve_reference_type(ASN1_Type *type) {
+  ASN1_Typedef *match;
+  ASN1_Type *target;
+  Constraint *constraint;
+
+  if (type->type != _TYPE_REFERENCE)
+    return type;
+  if (type->reference.resolved == type) {
+    fprintf(stderr, "Type '%s' is defined in terms of itself\n", type->reference.reference_name);
+    return 0;
+  }
+  if (type->reference.resolved)
+    return type->reference.resolved;
+
+  match = asn1_lookup(type->reference.module, type->reference.reference_name);
+  if (!match) {
+    fprintf(stderr, "Type '%s' does not exist\n", type->reference.reference_name);
+    return 0;
+  }
+
+  /* mark it while following the chain, to catch A ::= B, B ::= A */
+  type->reference.resolved = type;
+  target = asn1_resolve_reference_type(match->type);
+  type->reference.resolved = 0;
+  if (!target)
+    return 0;
+  match->type = target;
+
+  /* a constraint on the reference, like Foo (SIZE(1..8)), overrides the one on Foo, so it needs a node of its own */
+  constraint = type->reference.constraint;
+  if (constraint && target->type != TYPE_SEQUENCE && target->type != TYPE_CHOICE && target->type != TYPE_NULL) {
+    target = type_alloc(&schema, *target);
+    if (target->type == TYPE_LIST)
+      target->list.constraint = constraint;
+    else
+      target->primitive.constraint = constraint;
+  }
+
+  type->reference.resolved = target;
+  return target;
+}
+
+/* Points every use of a reference at the type it stands for. Recursive types just become cycles */
+static int asn1_resolve_type_children(ASN1_Type *type) {
+  Tag *tag;
+  Array(Tag) tags;
+
+  switch (type->type) {
+    case TYPE_CHOICE:
+    case TYPE_SEQUENCE:
+      tags = type->type == TYPE_CHOICE ? type->choice.choices : type->sequence.items;
+      array_foreach(tags, tag) {
+        tag->type = asn1_resolve_reference_type(tag->type);
+        if (!tag->type)
+          return 1;
+      }
+      return 0;
+    case TYPE_LIST:
+      type->list.item_type = asn1_resolve_reference_type(type->list.item_type);
+      return !type->list.item_type;
+    case TYPE_OCTET_STRING:
+    case TYPE_BIT_STRING:
+      if (!type->primitive.contains)
+        return 0;
+      type->primitive.contains = asn1_resolve_reference_type(type->primitive.contains);
+      return !type->primitive.contains;
+    default:
+      return 0;
+  }
+}
+
+ASN1_Typedef *asn1_find_type(Array(ASN1_Typedef) parsed_types, const char *name) {
+  int i;
+  i = symtab_find(&type_table, name);
+  return i < 0 ? 0 : parsed_types+i;
+}
+
+void asn1_index_types(Array(ASN1_Typedef) parsed_types) {
+  int i;
+  symtab_free(&type_table);
+  for (i = 0; i < array_len(parsed_types); ++i)
+    symtab_add(&type_table, parsed_types[i].name, i);
+}
+
+static void asn1_parse_file(ParseContext *ctx) {
+  yyscan_t scanner;
+  FILE *f;
+
+  f = fopen(ctx->filename, "rb");
+  if (!f) {
+    fprintf(stderr, "Could not find file '%s': %s\n", ctx->filename, strerror(errno));
+    exit(1);
+  }
+
+  yylex_init_extra(ctx, &scanner);
+  yyset_in(f, scanner);
+  yyparse(scanner);
+  yylex_destroy(scanner);
+
+  fclose(f);
+}
+
+#ifdef PARSE_IN_PARALLEL
+typedef struct {
+  ParseContext *files;
+  int first, step, num_files;
+} ParseThread;
+
+static void *asn1_parse_thread(void *arg) {
+  ParseThread *t = arg;
+  int i;
+  for (i = t->first; i < t->num_files; i += t->step)
+    asn1_parse_file(t->files+i);
+  return 0;
+}
+#endif
+
+/* Parses the files and adds what they define to the schema */
+static void asn1_parse_files(const char **filenames, int num_files) {
+  ParseContext *files, *ctx;
+  ASN1_Module **m;
+  int i, j;
+
+  files = calloc(num_files, sizeof(*files));
+  for (i = 0; i < num_files; ++i)
+    files[i].filename = filenames[i];
+
+  /* parse each file, spread over as many threads as there are cores */
+  #ifdef PARSE_IN_PARALLEL
+  {
+    pthread_t *threads;
+    ParseThread *args;
+    int num_threads;
+
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > num_files)
+      num_threads = num_files;
+    if (num_threads < 1)
+      num_threads = 1;
+
+    threads = malloc(num_threads * sizeof(*threads));
+    args = malloc(num_threads * sizeof(*args));
+    for (i = 0; i < num_threads; ++i) {
+      args[i].files = files;
+      args[i].first = i;
+      args[i].step = num_threads;
+      args[i].num_files = num_files;
+      if (i > 0 && pthread_create(&threads[i], 0, asn1_parse_thread, &args[i])) {
+        fprintf(stderr, "Failed to start parser thread: %s\n", strerror(errno));
+        exit(1);
+      }
+    }
+    /* the first share is parsed on this thread */
+    asn1_parse_thread(&args[0]);
+    for (i = 1; i < num_threads; ++i)
+      pthread_join(threads[i], 0);
+    free(threads);
+    free(args);
+  }
+  #else
+  for (i = 0; i < num_files; ++i)
+    asn1_parse_file(files+i);
+  #endif
+
+  /* merge them in the order the files were given, so it doesn't matter which one finished first.
+   * If a type or module name is defined twice, the first one wins */
+  for (i = 0; i < num_files; ++i) {
+    ctx = files+i;
+    for (j = 0; j < array_len(ctx->types); ++j)
+      symtab_add(&type_table, ctx->types[j]->name, array_len(schema.types) + j);
+    for (j = 0; j < array_len(ctx->values); ++j)
+      symtab_add(&value_table, ctx->values[j].name, array_len(schema.values) + j);
+    array_foreach(ctx->modules, m)
+      symtab_add(&module_table, (*m)->name, array_len(schema.modules) + (int)(m - ctx->modules));
+    array_push_a(schema.modules, ctx->modules, array_len(ctx->modules));
+    array_push_a(schema.types, ctx->types, array_len(ctx->types));
+    array_push_a(schema.type_nodes, ctx->type_nodes, array_len(ctx->type_nodes));
+    array_push_a(schema.constraints, ctx->constraints, array_len(ctx->constraints));
+    array_push_a(schema.values, ctx->values, array_len(ctx->values));
+    array_free(ctx->modules);
+    array_free(ctx->types);
+    array_free(ctx->type_nodes);
+    array_free(ctx->constraints);
+    array_free(ctx->values);
+    array_push(parsed_files, ctx->filename);
+  }
+  free(files);
+}
+
+/* A hash table from addresses to nonzero values, for walking the type graph, which can have cycles */
+typedef struct {
+  struct PointerMapSlot {
+    const void *ptr;
+    uint64_t value;
+  } *slots;
+  int num_slots, num_used;
+} PointerMap;
+
+static uint64_t ptrmap_find(PointerMap *m, const void *ptr) {
+  int i;
+  if (!m->num_slots)
+    return 0;
+  for (i = ((uintptr_t)ptr >> 3) & (m->num_slots-1); m->slots[i].ptr; i = (i+1) & (m->num_slots-1))
+    if (m->slots[i].ptr == ptr)
+      return m->slots[i].value;
+  return 0;
+}
+
+static void ptrmap_add(PointerMap *m, const void *ptr, uint64_t value) {
+  PointerMap old = *m;
+  int i;
+
+  if (2*(m->num_used+1) > m->num_slots) {
+    m->num_slots = old.num_slots ? old.num_slots*2 : 256;
+    m->slots = calloc(m->num_slots, sizeof(*m->slots));
+    m->num_used = 0;
+    for (i = 0; i < old.num_slots; ++i)
+      if (old.slots[i].ptr)
+        ptrmap_add(m, old.slots[i].ptr, old.slots[i].value);
+    free(old.slots);
+  }
+  for (i = ((uintptr_t)ptr >> 3) & (m->num_slots-1); m->slots[i].ptr; i = (i+1) & (m->num_slots-1));
+  m->slots[i].ptr = ptr;
+  m->slots[i].value = value;
+  ++m->num_used;
+}
+
+static void ptrmap_free(PointerMap *m) {
+  free(m->slots);
+  m->slots = 0;
+  m->num_slots = m->num_used = 0;
+}
+
+/* adds the directory of a file to the module path */
+static void asn1_module_path_add_dir_of(const char *filename) {
+  const char *end;
+  char *dir;
+
+  end = strrchr(filename, '/');
+  #if defined(_WIN32) || defined(_WIN64)
+  if (strrchr(filename, '\\') > end)
+    end = strrchr(filename, '\\');
+  #endif
+  if (!end) {
+    asn1_module_path_add(".");
+    return;
+  }
+  dir = malloc(end - filename + 1);
+  memcpy(dir, filename, end - filename);
+  dir[end - filename] = 0;
+  asn1_module_path_add(dir);
+}
+
+Array(ASN1_Typedef) asn1_parse(const char **filenames, int num_files) {
+  Array(ASN1_Typedef) result = 0;
+  Array(ASN1_Type*) stack = 0;
+  PointerMap reached = {0};
+  Constraint *constraint;
+  Array(Tag) tags;
+  ASN1_Type *type;
+  Tag *tag;
+  int i, num_given;
+
+  builtin_types_init();
+
+  /* imported modules are also looked for next to the given files */
+  for (i = 0; i < num_files; ++i)
+    asn1_module_path_add_dir_of(filenames[i]);
+
+  asn1_parse_files(filenames, num_files);
+
+  /* resolve reference types and named bounds in constraints, starting from the typedefs of the given files.
+   * Imported modules get parsed when a reference leads to them, but only what is reached in them is resolved */
+  num_given = array_len(schema.types);
+  for (i = 0; i < num_given; ++i) {
+    type = asn1_resolve_reference_type(schema.types[i]->type);
+    schema.types[i]->type = type;
+    if (!type) {
+      fprintf(stderr, "Failed to resolve reftypes, exiting..\n");
+      exit(1);
+    }
+    array_push(stack, type);
   }
+  while (array_len(stack)) {
+    type = *array_last(stack);
+    array_resize(stack, array_len(stack)-1);
+    if (ptrmap_find(&reached, type))
+      continue;
+    ptrmap_add(&reached, type, 1);
 
-  /* resolve reference types */
-  for (i = 0; i < array_len(type_references); ++i)
-    if (asn1_resolve_reference_type(type_references[i])) {
+    if (asn1_resolve_type_children(type)) {
       fprintf(stderr, "Failed to resolve reftypes, exiting..\n");
       exit(1);
     }
+    constraint = asn1_type_constraint(type);
+    if (constraint && asn1_resolve_constraint(constraint)) {
+      fprintf(stderr, "Failed to resolve constraints, exiting..\n");
+      exit(1);
+    }
+    if (type->type == TYPE_LIST)
+      array_push(stack, type->list.item_type);
+    else if ((type->type == TYPE_OCTET_STRING || type->type == TYPE_BIT_STRING) && type->primitive.contains)
+      array_push(stack, type->primitive.contains);
+    else if (type->type == TYPE_CHOICE || type->type == TYPE_SEQUENCE) {
+      tags = type->type == TYPE_CHOICE ? type->choice.choices : type->sequence.items;
+      array_foreach(tags, tag)
+        array_push(stack, tag->type);
+    }
+  }
+  array_free(stack);
 
+  /* typedefs of imported modules that nothing reached are left out, since they were never resolved */
+  for (i = 0; i < array_len(schema.types); ++i)
+    if (i < num_given || ptrmap_find(&reached, schema.types[i]->type))
+      array_push(result, *schema.types[i]);
+  array_free(schema.types);
+  ptrmap_free(&reached);
+  asn1_index_types(result);
 
-  for (i = 0; i < array_len(types); ++i) {
-    if (types[i]->type->type == TYPE_UNKNOWN) {
-      fprintf(stderr, "Unable to parse type of %s, exiting..\n", types[i]->name);
+  for (i = 0; i < array_len(result); ++i) {
+    if (result[i].type->type == TYPE_UNKNOWN) {
+      fprintf(stderr, "Unable to parse type of %s, exiting..\n", result[i].name);
       exit(1);
     }
   }
 
   /* print the types */
   #if 0
-  for (i = 0; i < array_len(types); ++i) {
-    ASN1_Type *t = types[i]->type;
-    printf("%s => ", types[i]->name);
+  for (i = 0; i < array_len(result); ++i) {
+    ASN1_Type *t = result[i].type;
+    printf("%s => ", result[i].name);
     for (;;) {
       switch (t->type) {
         case TYPE_UNKNOWN:
           printf("UNKNOWN");
           break;
         case TYPE_CHOICE:
-          printf("CHOICE - #tags: %i", array_len(t->choice.choices)); 
+          printf("CHOICE - #tags: %lli", array_len(t->choice.choices)); 
           break;
         case TYPE_SEQUENCE:
-          printf("SEQUENCE - #tags: %i", array_len(t->sequence.items)); 
+          printf("SEQUENCE - #tags: %lli", array_len(t->sequence.items)); 
           break;
         case _TYPE_REFERENCE:
           printf("typedef of '%s'", t->reference.reference_name);
@@ -198,11 +852,624 @@ Array(ASN1_Typedef) asn1_parse(const char **filenames, int num_files) {
   }
   #endif
 
-  array_resize(result, array_len(types));
-  for (i = 0; i < array_len(types); ++i)
-    result[i] = *types[i];
-  array_free(types);
+  return result;
+}
+
+/* Marks type and everything it refers to as reached, counting the type nodes and tags on the way.
+ * Uses a stack rather than recursion, since chains of types can be very long */
+static void asn1_reach(PointerMap *reached, ASN1_Type *type, SchemaStats *stats) {
+  ArrayBuffer(ASN1_Type*, 64) stack_buffer;
+  Array(ASN1_Type*) stack = array_init_buffer(stack_buffer);
+  Array(Tag) tags;
+  Tag *tag;
+
+  array_push(stack, type);
+  while (array_len(stack)) {
+    type = *array_last(stack);
+    array_resize(stack, array_len(stack)-1);
+    if (ptrmap_find(reached, type))
+      continue;
+    ptrmap_add(reached, type, 1);
+    ++stats->nodes;
+
+    if (type->type == TYPE_LIST)
+      array_push(stack, type->list.item_type);
+    else if ((type->type == TYPE_OCTET_STRING || type->type == TYPE_BIT_STRING) && type->primitive.contains)
+      array_push(stack, type->primitive.contains);
+    else if (type->type == TYPE_CHOICE || type->type == TYPE_SEQUENCE) {
+      tags = type->type == TYPE_CHOICE ? type->choice.choices : type->sequence.items;
+      stats->tags += array_len(tags);
+      array_foreach(tags, tag)
+        array_push(stack, tag->type);
+    }
+  }
+  array_free(stack);
+}
+
+Array(ASN1_Typedef) asn1_prune(Array(ASN1_Typedef) parsed_types, const char **roots, int num_roots, SchemaStats *before, SchemaStats *after) {
+  PointerMap all = {0}, reached = {0};
+  Array(ASN1_Typedef) result = 0;
+  ASN1_Type *t;
+  ASN1_Typedef *root;
+  int i;
+
+  memset(after, 0, sizeof(*after));
+
+  /* counting everything is only needed for the statistics */
+  if (before) {
+    memset(before, 0, sizeof(*before));
+    for (i = 0; i < array_len(parsed_types); ++i)
+      asn1_reach(&all, parsed_types[i].type, before);
+    before->types = array_len(parsed_types);
+  }
+
+  for (i = 0; i < num_roots; ++i) {
+    root = asn1_find_type(parsed_types, roots[i]);
+    if (root)
+      asn1_reach(&reached, root->type, after);
+  }
+
+  for (i = 0; i < array_len(parsed_types); ++i)
+    if (ptrmap_find(&reached, parsed_types[i].type))
+      array_push(result, parsed_types[i]);
+  after->types = array_len(result);
+
+  /* free the parsed type nodes that nothing can reach anymore.
+   * Constraints and name tables can be shared with the nodes that are kept, so they stay */
+  for (i = 0; i < array_len(schema.type_nodes); ++i) {
+    t = schema.type_nodes[i];
+    if (ptrmap_find(&reached, t))
+      continue;
+    if (t->type == TYPE_CHOICE)
+      array_free(t->choice.choices);
+    else if (t->type == TYPE_SEQUENCE)
+      array_free(t->sequence.items);
+    free(t);
+  }
+  array_free(schema.type_nodes);
 
+  ptrmap_free(&all);
+  ptrmap_free(&reached);
+  asn1_index_types(result);
   return result;
 }
 
+/* Finds the field that a path of dot separated field names leads to from type, going through SEQUENCE OF on the way */
+static Tag *asn1_field_find(ASN1_Type *type, const char *path) {
+  Array(Tag) tags;
+  Tag *tag;
+  const char *end;
+  int len;
+
+  for (;;) {
+    while (type->type == TYPE_LIST)
+      type = type->list.item_type;
+    if (type->type != TYPE_CHOICE && type->type != TYPE_SEQUENCE)
+      return 0;
+    tags = type->type == TYPE_CHOICE ? type->choice.choices : type->sequence.items;
+
+    end = strchr(path, '.');
+    len = end ? (int)(end - path) : (int)strlen(path);
+    array_foreach(tags, tag)
+      if (!strncmp(tag->name, path, len) && !tag->name[len])
+        break;
+    if (tag == array_end(tags))
+      return 0;
+    if (!end)
+      return tag;
+    type = tag->type;
+    path = end+1;
+  }
+}
+
+Array(Tag*) asn1_fields_find(Array(ASN1_Typedef) parsed_types, const char *path) {
+  PointerMap seen = {0};
+  Array(ASN1_Type*) stack = 0;
+  Array(Tag*) fields = 0;
+  Array(Tag) tags;
+  ASN1_Typedef *root;
+  ASN1_Type *type;
+  Tag *tag;
+  const char *dot;
+  char *root_name;
+  int i;
+
+  dot = path ? strchr(path, '.') : 0;
+  if (dot) {
+    root_name = malloc(dot - path + 1);
+    memcpy(root_name, path, dot - path);
+    root_name[dot - path] = 0;
+    root = asn1_find_type(parsed_types, root_name);
+    free(root_name);
+    tag = root ? asn1_field_find(root->type, dot+1) : 0;
+    if (tag)
+      array_push(fields, tag);
+    return fields;
+  }
+
+  /* every field with that name, anywhere in the schema */
+  array_reserve(stack, array_len(parsed_types));
+  for (i = 0; i < array_len(parsed_types); ++i)
+    array_push(stack, parsed_types[i].type);
+  while (array_len(stack)) {
+    type = *array_last(stack);
+    array_resize(stack, array_len(stack)-1);
+    if (ptrmap_find(&seen, type))
+      continue;
+    ptrmap_add(&seen, type, 1);
+
+    if (type->type == TYPE_LIST)
+      array_push(stack, type->list.item_type);
+    else if ((type->type == TYPE_OCTET_STRING || type->type == TYPE_BIT_STRING) && type->primitive.contains)
+      array_push(stack, type->primitive.contains);
+    else if (type->type == TYPE_CHOICE || type->type == TYPE_SEQUENCE) {
+      tags = type->type == TYPE_CHOICE ? type->choice.choices : type->sequence.items;
+      array_foreach(tags, tag) {
+        if (!path || !strcmp(tag->name, path))
+          array_push(fields, tag);
+        array_push(stack, tag->type);
+      }
+    }
+  }
+  array_free(stack);
+  ptrmap_free(&seen);
+  return fields;
+}
+
+ASN1_Type *asn1_field_string(Tag *field) {
+  ASN1_Type **slot, *t;
+
+  for (t = field->type; t->type == TYPE_LIST; t = t->list.item_type);
+  if (t->type != TYPE_OCTET_STRING && t->type != TYPE_BIT_STRING)
+    return 0;
+
+  /* the string type, and any SEQUENCE OF nodes on the way to it, can be shared with other fields, so they are copied */
+  for (slot = &field->type;; slot = &(*slot)->list.item_type) {
+    *slot = type_alloc(&schema, **slot);
+    if ((*slot)->type != TYPE_LIST)
+      return *slot;
+  }
+}
+
+int asn1_contains_set(Array(ASN1_Typedef) parsed_types, const char *path, const char *type_name) {
+  Array(Tag*) fields;
+  ASN1_Typedef *contained;
+  ASN1_Type *string;
+  Tag **field;
+  int n;
+
+  contained = asn1_find_type(parsed_types, type_name);
+  if (!contained)
+    return -1;
+
+  n = 0;
+  fields = asn1_fields_find(parsed_types, path);
+  array_foreach(fields, field) {
+    string = asn1_field_string(*field);
+    if (string)
+      string->primitive.contains = contained->type, ++n;
+  }
+  array_free(fields);
+  return n;
+}
+
+/* Compiled schemas
+ *
+ * A compiled schema is an image of the resolved types, as they are laid out in memory, but with every
+ * pointer replaced by its offset from the start of the image. The image ends with a list of where all
+ * those pointers are, so loading it is just mapping the file and adding the base address to each of them.
+ * The image also records the source files it was compiled from, so that it can tell when it is out of date */
+
+#define SCHEMA_MAGIC "ASN1SCH"
+#define SCHEMA_VERSION 7
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int pointer_size;
+  uint64_t size;
+  uint64_t types; /* Array(ASN1_Typedef) */
+  uint64_t sources; /* Array(SchemaSource) */
+  uint64_t roots; /* Array(char*), the type names it was pruned to, if any */
+  uint64_t contains; /* Array(char*), the PATH=TYPE arguments it was compiled with */
+  uint64_t display_hints; /* Array(char*), the display hint files it was compiled with */
+  uint64_t hint_sources; /* Array(SchemaSource), the same files, which make it out of date when they change too */
+  uint64_t relocs; /* the offset of every pointer in the image */
+  uint64_t num_relocs;
+} SchemaHeader;
+
+typedef struct {
+  char *path;
+  long long mtime;
+  long long size;
+  uint64_t hash;
+} SchemaSource;
+
+static Array(unsigned char) image;
+static Array(uint64_t) image_relocs;
+
+/* what has already been written to the image, from its address in memory to its offset in the image */
+static PointerMap image_saved;
+/* types that have been written, but not their children */
+static Array(ASN1_Type*) image_pending;
+
+/* returns the offset of size zeroed bytes at the end of the image */
+static uint64_t image_alloc(uint64_t size) {
+  uint64_t old, at;
+  old = array_len(image);
+  at = (old + 7) & ~7;
+  array_resize(image, at + size);
+  memset(image + old, 0, at + size - old);
+  return at;
+}
+
+/* sets the pointer at offset at in the image to point at offset target, or to 0 if target is 0 */
+static void image_ptr(uint64_t at, uint64_t target) {
+  char *p = (char*)(uintptr_t)target;
+  memcpy(image + at, &p, sizeof(p));
+  if (target)
+    array_push(image_relocs, at);
+}
+
+static uint64_t image_string(const char *s) {
+  uint64_t off;
+  if (!s)
+    return 0;
+  off = ptrmap_find(&image_saved, s);
+  if (off)
+    return off;
+  off = image_alloc(strlen(s)+1);
+  strcpy((char*)image + off, s);
+  ptrmap_add(&image_saved, s, off);
+  return off;
+}
+
+/* copies the elements of an array to the image, along with its length and capacity */
+static uint64_t image_array(const void *a, int elem_size) {
+  uint64_t off;
+  long long n;
+  if (!a)
+    return 0;
+  n = array_len((char*)a);
+  off = image_alloc(2*sizeof(n) + n*elem_size) + 2*sizeof(n);
+  memcpy(image + off - 2*sizeof(n), &n, sizeof(n));
+  memcpy(image + off - sizeof(n), &n, sizeof(n));
+  memcpy(image + off, a, n*elem_size);
+  return off;
+}
+
+static uint64_t image_strings(const char **strings) {
+  uint64_t off, s;
+  int i;
+  off = image_array(strings, sizeof(*strings));
+  for (i = 0; i < array_len(strings); ++i) {
+    s = image_string(strings[i]);
+    image_ptr(off + i*sizeof(char*), s);
+  }
+  return off;
+}
+
+static uint64_t image_type(ASN1_Type *type);
+
+static uint64_t image_tags(Array(Tag) tags) {
+  uint64_t off, name, type;
+  int i;
+  off = image_array(tags, sizeof(*tags));
+  for (i = 0; i < array_len(tags); ++i) {
+    name = image_string(tags[i].name);
+    type = image_type(tags[i].type);
+    image_ptr(off + i*sizeof(Tag) + offsetof(Tag, name), name);
+    image_ptr(off + i*sizeof(Tag) + offsetof(Tag, type), type);
+  }
+  return off;
+}
+
+static uint64_t image_constraint(Constraint *c) {
+  uint64_t off;
+  if (!c)
+    return 0;
+  off = ptrmap_find(&image_saved, c);
+  if (off)
+    return off;
+  off = image_alloc(sizeof(*c));
+  memcpy(image + off, c, sizeof(*c));
+  image_ptr(off + offsetof(Constraint, min_name), 0);
+  image_ptr(off + offsetof(Constraint, max_name), 0);
+  image_ptr(off + offsetof(Constraint, module), 0);
+  ptrmap_add(&image_saved, c, off);
+  return off;
+}
+
+static uint64_t image_names(NameTable *table) {
+  uint64_t off, names, numbers, s;
+  int i;
+  if (!table)
+    return 0;
+  off = ptrmap_find(&image_saved, table);
+  if (off)
+    return off;
+  off = image_alloc(sizeof(*table));
+  memcpy(image + off, table, sizeof(*table));
+  ptrmap_add(&image_saved, table, off);
+
+  names = image_array(table->names, sizeof(*table->names));
+  for (i = 0; i < array_len(table->names); ++i) {
+    s = image_string(table->names[i]);
+    image_ptr(names + i*sizeof(char*), s);
+  }
+  numbers = image_array(table->numbers, sizeof(*table->numbers));
+  for (i = 0; i < array_len(table->numbers); ++i) {
+    s = image_string(table->numbers[i].name);
+    image_ptr(numbers + i*sizeof(NamedNumber) + offsetof(NamedNumber, name), s);
+  }
+  image_ptr(off + offsetof(NameTable, names), names);
+  image_ptr(off + offsetof(NameTable, numbers), numbers);
+  return off;
+}
+
+static uint64_t image_type(ASN1_Type *type) {
+  uint64_t off;
+  if (!type)
+    return 0;
+  off = ptrmap_find(&image_saved, type);
+  if (off)
+    return off;
+  /* the children are written later, since chains of types can be too long to recurse through */
+  off = image_alloc(sizeof(*type));
+  memcpy(image + off, type, sizeof(*type));
+  ptrmap_add(&image_saved, type, off);
+  array_push(image_pending, type);
+  return off;
+}
+
+static void image_type_children(ASN1_Type *type) {
+  uint64_t off, a, b;
+
+  off = ptrmap_find(&image_saved, type);
+  switch (type->type) {
+    case TYPE_UNKNOWN:
+    case TYPE_NULL:
+    case _TYPE_REFERENCE:
+      break;
+    case TYPE_CHOICE:
+      a = image_tags(type->choice.choices);
+      image_ptr(off + offsetof(ASN1_Type, choice.choices), a);
+      break;
+    case TYPE_SEQUENCE:
+      a = image_tags(type->sequence.items);
+      image_ptr(off + offsetof(ASN1_Type, sequence.items), a);
+      break;
+    case TYPE_LIST:
+      a = image_type(type->list.item_type);
+      b = image_constraint(type->list.constraint);
+      image_ptr(off + offsetof(ASN1_Type, list.item_type), a);
+      image_ptr(off + offsetof(ASN1_Type, list.constraint), b);
+      break;
+    default:
+      a = image_constraint(type->primitive.constraint);
+      b = image_names(type->primitive.names);
+      image_ptr(off + offsetof(ASN1_Type, primitive.constraint), a);
+      image_ptr(off + offsetof(ASN1_Type, primitive.names), b);
+      if ((type->type == TYPE_OCTET_STRING || type->type == TYPE_BIT_STRING) && type->primitive.contains) {
+        a = image_type(type->primitive.contains);
+        image_ptr(off + offsetof(ASN1_Type, primitive.contains), a);
+      }
+      break;
+  }
+}
+
+/* FNV-1a of a file's contents. Returns 1 if the file couldn't be read */
+static int schema_source_hash(const char *path, uint64_t *hash) {
+  unsigned char buf[1 << 16];
+  size_t i, n;
+  FILE *f;
+
+  f = fopen(path, "rb");
+  if (!f)
+    return 1;
+  *hash = 14695981039346656037ull;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    for (i = 0; i < n; ++i)
+      *hash = (*hash ^ buf[i]) * 1099511628211ull;
+  fclose(f);
+  return 0;
+}
+
+static int schema_source_stat(const char *path, SchemaSource *s) {
+  struct stat st;
+  if (stat(path, &st))
+    return 1;
+  s->mtime = (long long)st.st_mtime;
+  s->size = (long long)st.st_size;
+  return 0;
+}
+
+/* Writes an Array(SchemaSource) of the files to the image. Returns nonzero if one of them can't be read */
+static int image_sources(const char **filenames, long long n, uint64_t *sources) {
+  SchemaSource source;
+  char *full_path;
+  uint64_t s;
+  int i;
+
+  /* remember the sources by their full path, so the schema can be used from any directory */
+  *sources = image_alloc(2*sizeof(n) + n*sizeof(SchemaSource)) + 2*sizeof(n);
+  memcpy(image + *sources - 2*sizeof(n), &n, sizeof(n));
+  memcpy(image + *sources - sizeof(n), &n, sizeof(n));
+  for (i = 0; i < n; ++i) {
+    if (schema_source_stat(filenames[i], &source) || schema_source_hash(filenames[i], &source.hash))
+      return 1;
+    #if defined(_WIN32) || defined(_WIN64)
+      full_path = _fullpath(0, filenames[i], 0);
+    #else
+      full_path = realpath(filenames[i], 0);
+    #endif
+    s = image_string(full_path ? full_path : filenames[i]);
+    memcpy(image + *sources + i*sizeof(SchemaSource), &source, sizeof(source));
+    image_ptr(*sources + i*sizeof(SchemaSource) + offsetof(SchemaSource, path), s);
+  }
+  return 0;
+}
+
+int asn1_schema_save(Array(ASN1_Typedef) parsed_types, const char **filenames, int num_files, SchemaOptions *options, const char *path) {
+  SchemaHeader header = {{0}};
+  uint64_t off, types, sources, roots, contains, display_hints, hint_sources, s;
+  ASN1_Type *t;
+  FILE *f;
+  int i, ok;
+
+  image_alloc(sizeof(header));
+
+  types = image_array(parsed_types, sizeof(*parsed_types));
+  for (i = 0; i < array_len(parsed_types); ++i) {
+    s = image_string(parsed_types[i].name);
+    image_ptr(types + i*sizeof(ASN1_Typedef) + offsetof(ASN1_Typedef, name), s);
+    s = image_type(parsed_types[i].type);
+    image_ptr(types + i*sizeof(ASN1_Typedef) + offsetof(ASN1_Typedef, type), s);
+  }
+  while (array_len(image_pending)) {
+    t = *array_last(image_pending);
+    array_resize(image_pending, array_len(image_pending)-1);
+    image_type_children(t);
+  }
+
+  if (image_sources(filenames, num_files, &sources) || image_sources(options->display_hints, array_len(options->display_hints), &hint_sources))
+    return 1;
+
+  roots = image_strings(options->roots);
+  contains = image_strings(options->contains);
+  display_hints = image_strings(options->display_hints);
+
+  off = image_alloc(array_len(image_relocs) * sizeof(*image_relocs));
+  memcpy(image + off, image_relocs, array_len(image_relocs) * sizeof(*image_relocs));
+
+  memcpy(header.magic, SCHEMA_MAGIC, sizeof(SCHEMA_MAGIC));
+  header.version = SCHEMA_VERSION;
+  header.pointer_size = sizeof(void*);
+  header.size = array_len(image);
+  header.types = types;
+  header.sources = sources;
+  header.roots = roots;
+  header.contains = contains;
+  header.display_hints = display_hints;
+  header.hint_sources = hint_sources;
+  header.relocs = off;
+  header.num_relocs = array_len(image_relocs);
+  memcpy(image, &header, sizeof(header));
+
+  f = fopen(path, "wb");
+  ok = f && fwrite(image, 1, array_len(image), f) == (size_t)array_len(image);
+  if (f && fclose(f))
+    ok = 0;
+
+  array_free(image);
+  array_free(image_relocs);
+  array_free(image_pending);
+  ptrmap_free(&image_saved);
+  return !ok;
+}
+
+int asn1_schema_is_compiled(const char *path) {
+  char magic[8];
+  FILE *f;
+  int r;
+
+  f = fopen(path, "rb");
+  if (!f)
+    return 0;
+  r = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, SCHEMA_MAGIC, sizeof(SCHEMA_MAGIC));
+  fclose(f);
+  return r;
+}
+
+static void asn1_schema_invalid(const char *path) {
+  fprintf(stderr, "%s is not a valid compiled schema for this build, compile it again with --compile-schema\n", path);
+  exit(1);
+}
+
+/* Whether any of the files a schema was compiled from changed. Only those whose size or time changed are read and hashed */
+static int schema_sources_changed(SchemaSource *sources, const char *path) {
+  SchemaSource current;
+  long long i;
+
+  for (i = 0; i < array_len(sources); ++i) {
+    if (schema_source_stat(sources[i].path, &current)) {
+      fprintf(stderr, "Could not find file '%s', that %s was compiled from: %s\n", sources[i].path, path, strerror(errno));
+      exit(1);
+    }
+    if (current.mtime == sources[i].mtime && current.size == sources[i].size)
+      continue;
+    if (schema_source_hash(sources[i].path, &current.hash) || current.hash != sources[i].hash)
+      return 1;
+  }
+  return 0;
+}
+
+Array(ASN1_Typedef) asn1_schema_load(const char *path, Array(char*) *stale_sources, SchemaOptions *stale_options) {
+  SchemaHeader header;
+  SchemaSource *sources;
+  char *base, **p;
+  uint64_t i, *relocs;
+  struct stat st;
+  int stale = 0;
+
+  /* map the file with private pages, so relocating only copies the pages with pointers on them */
+  #if defined(_WIN32) || defined(_WIN64)
+  {
+    FILE *f;
+    f = fopen(path, "rb");
+    if (!f || fstat(fileno(f), &st))
+      asn1_schema_invalid(path);
+    base = malloc(st.st_size);
+    if (fread(base, 1, st.st_size, f) != (size_t)st.st_size)
+      asn1_schema_invalid(path);
+    fclose(f);
+  }
+  #else
+  {
+    int fd;
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st))
+      asn1_schema_invalid(path);
+    base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+      asn1_schema_invalid(path);
+    close(fd);
+  }
+  #endif
+
+  if ((uint64_t)st.st_size < sizeof(header))
+    asn1_schema_invalid(path);
+  memcpy(&header, base, sizeof(header));
+  if (memcmp(header.magic, SCHEMA_MAGIC, sizeof(SCHEMA_MAGIC)) || header.version != SCHEMA_VERSION ||
+      header.pointer_size != sizeof(void*) || header.size != (uint64_t)st.st_size ||
+      header.relocs > header.size || header.num_relocs > (header.size - header.relocs) / sizeof(uint64_t))
+    asn1_schema_invalid(path);
+
+  relocs = (uint64_t*)(base + header.relocs);
+  for (i = 0; i < header.num_relocs; ++i) {
+    if (relocs[i] > header.size - sizeof(char*))
+      asn1_schema_invalid(path);
+    p = (char**)(base + relocs[i]);
+    if ((uintptr_t)*p >= header.size)
+      asn1_schema_invalid(path);
+    *p = base + (uintptr_t)*p;
+  }
+
+  sources = (SchemaSource*)(base + header.sources);
+  for (i = 0; i < (uint64_t)array_len(sources); ++i)
+    array_push(*stale_sources, sources[i].path);
+  stale = schema_sources_changed(sources, path) || schema_sources_changed((SchemaSource*)(base + header.hint_sources), path);
+  if (stale) {
+    if (header.roots)
+      array_push_a(stale_options->roots, (const char**)(base + header.roots), array_len((char**)(base + header.roots)));
+    if (header.contains)
+      array_push_a(stale_options->contains, (const char**)(base + header.contains), array_len((char**)(base + header.contains)));
+    if (header.display_hints)
+      array_push_a(stale_options->display_hints, (const char**)(base + header.display_hints), array_len((char**)(base + header.display_hints)));
+    return 0;
+  }
+  array_free(*stale_sources);
+
+  asn1_index_types((ASN1_Typedef*)(base + header.types));
+  return (ASN1_Typedef*)(base + header.types);
+}
@@ -2,18 +2,33 @@
 #include "parser.c"
 %}
 
-%token TOK_NULL ENUMERATED SIZE UTF8_STRING PRINTABLE_STRING IA5_STRING BIT_STRING BOOLEAN OCTET_STRING INTEGER DOUBLEDOT TRIPLEDOT TAGS BEGIN_ END_ DEFINITIONS IMPLICIT CHOICE SEQUENCE OF OPTIONAL NAME ASSIGNMENT NUMBER
+%define api.pure full
+%parse-param {yyscan_t scanner}
+%lex-param {yyscan_t scanner}
+
+%token TOK_NULL ENUMERATED SIZE UTF8_STRING PRINTABLE_STRING IA5_STRING BIT_STRING BOOLEAN OCTET_STRING INTEGER DOUBLEDOT TRIPLEDOT TAGS BEGIN_ END_ DEFINITIONS IMPLICIT CHOICE SEQUENCE OF OPTIONAL NAME ASSIGNMENT NUMBER IMPORTS EXPORTS FROM ALL CONTAINING
 
 %union
 {
-  int number;
+  long long number;
   char *string;
   ASN1_Type* type;
   Array(Tag) tags;
   Tag tag;
   unsigned int flag;
+  Constraint *constraint;
+  NamedNumber named_number;
+  struct {
+    Array(NamedNumber) numbers;
+    int extensible;
+  } named_numbers;
+  Array(char*) names;
 }
 
+%{
+int yylex(YYSTYPE *lval, yyscan_t scanner);
+%}
+
 %token <number> NUMBER
 %token <string> NAME
 %type <tags> tags
@@ -21,44 +36,76 @@
 %type <type> type
 %type <flag> tagflags
 %type <flag> tagflag
+%type <constraint> sizeinfo range irange
+%type <named_numbers> enumdecl enums
+%type <named_number> enum
+%type <names> names
 
 %%
 commands: | commands command ;
 
 command:
-  NAME DEFINITIONS cmdflags ASSIGNMENT BEGIN_ definitions END_ ;
+  NAME oid DEFINITIONS cmdflags ASSIGNMENT BEGIN_
+  { asn1_module_begin(CTX, $1); }
+  exports imports definitions END_ ;
 
 cmdflags: | cmdflags cmdflag ;
 
 cmdflag: IMPLICIT | TAGS ;
 
+/* module identifiers, like { itu-t (0) identified-organization (4) etsi (0) }. Only the names of modules are used */
+oid: | '{' oidparts '}' ;
+
+oidparts: oidpart | oidparts oidpart ;
+
+oidpart: NAME | NUMBER | NAME '(' NUMBER ')' ;
+
+/* everything can be imported, so exports are ignored */
+exports: | EXPORTS ALL ';' | EXPORTS names ';' | EXPORTS ';' ;
+
+imports: | IMPORTS importlists ';' ;
+
+importlists: | importlists importlist ;
+
+importlist:
+  names FROM NAME oid
+  { asn1_import_add(CTX, $1, $3); } ;
+
+names:
+  NAME
+  { $$ = 0; array_push($$, $1); } |
+
+  names ',' NAME
+  { $$ = $1; array_push($$, $3); } ;
+
 definitions: | definitions definition ;
 
 definition:
   NAME ASSIGNMENT type
   { 
-    array_push(types, asn1_typedef_create($3, $1));
+    asn1_typedef_add(CTX, asn1_typedef_create($3, $1));
   } |
 
-  NAME INTEGER ASSIGNMENT NUMBER ;
+  NAME INTEGER ASSIGNMENT NUMBER
+  { asn1_value_create(CTX, $1, $4); } ;
 
 type:
   NAME
-  { $$ = asn1_typeref_create($1); array_push(type_references, $$); } |
+  { $$ = asn1_typeref_create(CTX, $1); } |
 
   NAME sizeinfo
-  { $$ = asn1_typeref_create($1); array_push(type_references, $$); } |
+  { $$ = asn1_typeref_create(CTX, $1); $$->reference.constraint = $2; } |
 
   CHOICE '{' tags '}'
-  { $$ = asn1_choice_create((Array(Tag))$3); } |
+  { $$ = asn1_choice_create(CTX, (Array(Tag))$3); } |
 
   SEQUENCE '{' tags '}'
-  { $$ = asn1_sequence_create((Array(Tag))$3); } |
+  { $$ = asn1_sequence_create(CTX, (Array(Tag))$3); } |
 
   SEQUENCE sizeinfo OF type
-  { $$ = asn1_list_create($4); } |
+  { $$ = asn1_list_create(CTX, $4); $$->list.constraint = $2; } |
   SEQUENCE OF type
-  { $$ = asn1_list_create($3); } |
+  { $$ = asn1_list_create(CTX, $3); } |
 
   TOK_NULL
   { $$ = &asn1_null_type; } |
@@ -69,41 +116,45 @@ type:
   OCTET_STRING
   { $$ = &asn1_octet_string_type; } |
   OCTET_STRING sizeinfo
-  { $$ = &asn1_octet_string_type; } |
+  { $$ = asn1_constrained_create(CTX, &asn1_octet_string_type, $2); } |
+  OCTET_STRING '(' CONTAINING type ')'
+  { $$ = asn1_containing_create(CTX, &asn1_octet_string_type, $4); } |
 
   BIT_STRING
   { $$ = &asn1_bit_string_type; } |
   BIT_STRING enumdecl
-  { $$ = &asn1_bit_string_type; } |
+  { $$ = asn1_named_create(CTX, &asn1_bit_string_type, $2.numbers, $2.extensible); } |
   BIT_STRING enumdecl sizeinfo
-  { $$ = &asn1_bit_string_type; } |
+  { $$ = asn1_named_create(CTX, &asn1_bit_string_type, $2.numbers, $2.extensible); $$->primitive.constraint = $3; } |
   BIT_STRING sizeinfo
-  { $$ = &asn1_bit_string_type; } |
+  { $$ = asn1_constrained_create(CTX, &asn1_bit_string_type, $2); } |
+  BIT_STRING '(' CONTAINING type ')'
+  { $$ = asn1_containing_create(CTX, &asn1_bit_string_type, $4); } |
 
   INTEGER
   { $$ = &asn1_integer_type; } |
   INTEGER enumdecl
-  { $$ = &asn1_integer_type; } |
+  { $$ = asn1_named_create(CTX, &asn1_integer_type, $2.numbers, $2.extensible); } |
   INTEGER range
-  { $$ = &asn1_integer_type; } |
+  { $$ = asn1_constrained_create(CTX, &asn1_integer_type, $2); } |
 
   UTF8_STRING
   { $$ = &asn1_utf8_string_type; } |
   UTF8_STRING sizeinfo
-  { $$ = &asn1_utf8_string_type; } |
+  { $$ = asn1_constrained_create(CTX, &asn1_utf8_string_type, $2); } |
 
   IA5_STRING
   { $$ = &asn1_ia5_string_type; } |
   IA5_STRING sizeinfo
-  { $$ = &asn1_ia5_string_type; } |
+  { $$ = asn1_constrained_create(CTX, &asn1_ia5_string_type, $2); } |
 
   PRINTABLE_STRING
   { $$ = &asn1_printable_string_type; } |
   PRINTABLE_STRING sizeinfo
-  { $$ = &asn1_printable_string_type; } |
+  { $$ = asn1_constrained_create(CTX, &asn1_printable_string_type, $2); } |
 
   ENUMERATED enumdecl
-  { $$ = &asn1_integer_type; } ;
+  { $$ = asn1_named_create(CTX, &asn1_enumerated_type, $2.numbers, $2.extensible); } ;
 
 tags:
   tags ',' tag
@@ -130,24 +181,38 @@ tagflag:
     { $$ = TAG_FLAG_OPTIONAL; }
 
 enumdecl: '{' enums '}'
+     { $$ = $2; } ;
 enums:
-     enums ',' enum |
-     enum ;
+     enums ',' enum
+     { $$ = $1; array_push($$.numbers, $3); } |
+     enums ',' TRIPLEDOT
+     { $$ = $1; $$.extensible = 1; } |
+     enum
+     { $$.numbers = 0; $$.extensible = 0; array_push($$.numbers, $1); } ;
 enum:
-  NAME '(' NUMBER ')' ;
+  NAME '(' NUMBER ')'
+  { $$.name = $1; $$.value = $3; } ;
 
 range:
-     '(' irange ')' |
-     '(' irange ',' TRIPLEDOT ')' ;
+     '(' irange ')'
+     { $$ = $2; } |
+     '(' irange ',' TRIPLEDOT ')'
+     { $$ = $2; $$->flags |= CONSTRAINT_EXTENSIBLE; } ;
 irange:
-     NUMBER DOUBLEDOT NUMBER |
-     NAME DOUBLEDOT NUMBER |
-     NUMBER DOUBLEDOT NAME |
-     NAME DOUBLEDOT NAME ;
+     NUMBER DOUBLEDOT NUMBER
+     { $$ = asn1_constraint_create(CTX, 0, $1, 0, $3, 0); } |
+     NAME DOUBLEDOT NUMBER
+     { $$ = asn1_constraint_create(CTX, 0, 0, $1, $3, 0); } |
+     NUMBER DOUBLEDOT NAME
+     { $$ = asn1_constraint_create(CTX, 0, $1, 0, 0, $3); } |
+     NAME DOUBLEDOT NAME
+     { $$ = asn1_constraint_create(CTX, 0, 0, $1, 0, $3); } ;
 
 sizeinfo:
-          '(' SIZE '(' NUMBER ')' ')' |
-          '(' SIZE range ')' ;
+          '(' SIZE '(' NUMBER ')' ')'
+          { $$ = asn1_constraint_create(CTX, CONSTRAINT_SIZE, $4, 0, $4, 0); } |
+          '(' SIZE range ')'
+          { $$ = $3; $$->flags |= CONSTRAINT_SIZE; } ;
 
 
 %%
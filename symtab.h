@@ -0,0 +1,104 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+/**
+*               Example
+*
+*   SymbolTable t = {0};
+*
+*   symtab_add(&t, "Foo", 3);
+*
+*   symtab_find(&t, "Foo");   => 3
+*   symtab_find(&t, "Bar");   => -1
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+/* API */
+
+typedef struct SymbolTable SymbolTable;
+typedef struct SymbolTableSlot SymbolTableSlot;
+
+struct SymbolTableSlot {
+  const char *name; /* 0 if empty */
+  unsigned int hash;
+  int value;
+};
+
+struct SymbolTable {
+  SymbolTableSlot *slots;
+  int num_slots; /* always 0 or a power of 2 */
+  int num_used;
+};
+
+/* Internals */
+static unsigned int symtab__hash(const char *name) {
+  /* FNV-1a */
+  unsigned int h = 2166136261u;
+  for (; *name; ++name)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h;
+}
+
+static SymbolTableSlot *symtab__slot(SymbolTable *t, const char *name, unsigned int hash) {
+  SymbolTableSlot *s;
+  int i;
+
+  for (i = hash & (t->num_slots-1);; i = (i+1) & (t->num_slots-1)) {
+    s = t->slots+i;
+    if (!s->name || (s->hash == hash && !strcmp(s->name, name)))
+      return s;
+  }
+}
+
+static void symtab__grow(SymbolTable *t) {
+  SymbolTable old = *t;
+  int i;
+
+  t->num_slots = old.num_slots ? old.num_slots*2 : 64;
+  t->slots = calloc(t->num_slots, sizeof(*t->slots));
+  for (i = 0; i < old.num_slots; ++i)
+    if (old.slots[i].name)
+      *symtab__slot(t, old.slots[i].name, old.slots[i].hash) = old.slots[i];
+  free(old.slots);
+}
+
+/* Returns the value of name, or -1 if it isn't in the table */
+static int symtab_find(SymbolTable *t, const char *name) {
+  SymbolTableSlot *s;
+
+  if (!t->num_slots)
+    return -1;
+  s = symtab__slot(t, name, symtab__hash(name));
+  return s->name ? s->value : -1;
+}
+
+/* The name is not copied, so it must outlive the table.
+ * Returns 1 if the name was already there, in which case the old value is kept */
+static int symtab_add(SymbolTable *t, const char *name, int value) {
+  SymbolTableSlot *s;
+  unsigned int hash;
+
+  /* keep it at most half full */
+  if (2*(t->num_used+1) > t->num_slots)
+    symtab__grow(t);
+
+  hash = symtab__hash(name);
+  s = symtab__slot(t, name, hash);
+  if (s->name)
+    return 1;
+  s->name = name;
+  s->hash = hash;
+  s->value = value;
+  ++t->num_used;
+  return 0;
+}
+
+static void symtab_free(SymbolTable *t) {
+  free(t->slots);
+  t->slots = 0;
+  t->num_slots = t->num_used = 0;
+}
+
+#endif /* SYMTAB_H */